@@ -0,0 +1,646 @@
+/* Benchmark of the to-do list's hot paths: loading and saving the list in
+ * both formats, printing it, and the commands that change it. Synthetic
+ * save files of the requested sizes are generated on first use and kept
+ * in a data directory, so that every run measures the same input. Each
+ * benchmark runs several times and the fastest and the median time are
+ * reported; the fastest time is the one to compare between builds.
+ *
+ * The benchmark includes main.cpp with TODOLIST_NO_MAIN defined, so that
+ * it calls the same functions the program does:
+ *
+ *     g++ -std=c++17 -O2 -pthread bench.cpp -o bench
+ *     ./bench --rows 10000,1000000
+ *
+ * Builds of older versions, such as the regex parser of the first
+ * release, can only be measured from the outside. `--program PATH` times
+ * starting such a program on each data set and leaving it through the menu.
+ */
+
+#define TODOLIST_NO_MAIN
+#include "main.cpp"
+
+// Sizes of the generated save files, in tasks
+#define BENCH_ROWS "10000,1000000,10000000"
+
+// Number of timed runs of every benchmark
+#define BENCH_REPEAT 5
+
+// Directory the generated files are kept in
+#define BENCH_DIRECTORY "./bench-data"
+
+// Seed of the generated data, the same for every run
+#define BENCH_SEED 1
+
+// Maximum number of commands of each kind per run of the mutation benchmark
+#define BENCH_CHANGES 10000
+
+// Deterministic random numbers (SplitMix64), so that every
+// run generates exactly the same data
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Number in [0, bound)
+    size_t below(size_t bound) { return next() % bound; }
+
+    // Whether an event with a chance of `percent` in 100 happens
+    bool chance(double percent) { return next() % 10000 < percent * 100; }
+
+private:
+    uint64_t state;
+};
+
+// Timings of every run of a single benchmark
+struct Result {
+    string name;
+    size_t rows = 0;        // Size of the data set
+    size_t items = 0;       // Tasks or commands handled per run
+    size_t bytes = 0;       // Bytes read or written per run, if any
+    vector<double> times{}; // Milliseconds of each run
+};
+
+// Options of the benchmark run
+struct Settings {
+    vector<size_t> rows;
+    size_t repeat = BENCH_REPEAT;
+    string directory = BENCH_DIRECTORY;
+    vector<string> programs;
+    bool tsv = false;
+};
+
+/**
+ *  @brief Writes a save file of synthetic tasks.
+ *
+ *  Titles and descriptions are made of common words, with the lengths
+ *  real lists have. Some of them contain quotes, commas, newlines and
+ *  non-ASCII characters, some tasks have no description or due date, and
+ *  a few have no ID, like files saved before tasks had one.
+ *
+ *  @param path Path of the file to write.
+ *  @param rows Number of tasks.
+ *  @param seed Seed of the random numbers.
+ *  @return `true` if the file was written, `false` if otherwise.
+ */
+bool generate_save_file(const string &path, size_t rows, uint64_t seed);
+
+// Forgets the loaded list, as if the program had just started
+void reset_list();
+
+/**
+ *  @brief Loads a save file into the globals, without timing it.
+ *
+ *  @param path Path of the save file.
+ */
+void load_list(const string &path);
+
+/**
+ *  @brief Runs a benchmark several times.
+ *
+ *  @param result Result to add the times to.
+ *  @param repeat Number of timed runs.
+ *  @param prepare Called before every run, not timed.
+ *  @param run Code to time.
+ */
+template <class Prepare, class Run>
+void measure(Result &result, size_t repeat, Prepare prepare, Run run);
+
+/**
+ *  @brief Times commands that change the list.
+ *
+ *  Every run loads the list afresh and then adds, marks, edits and
+ *  removes tasks through `run_command()`, the way a batch does. Journal
+ *  records are written, but not forced to disk.
+ *
+ *  @param settings Options of the benchmark run.
+ *  @param path Save file of the data set.
+ *  @param rows Number of tasks in the save file.
+ *  @param results Results to add to, one per command.
+ */
+void measure_changes(const Settings &settings, const string &path, size_t rows,
+                     vector<Result> &results);
+
+/**
+ *  @brief Times another build of the program starting on a save file.
+ *
+ *  The program is started in a directory holding a copy of the save
+ *  file and leaves through the menu right away, so the time covers
+ *  loading the list and whatever the program does on exit.
+ *
+ *  @param settings Options of the benchmark run.
+ *  @param program Path of the program.
+ *  @param path Save file of the data set.
+ *  @param rows Number of tasks in the save file.
+ *  @return Timings of the runs.
+ */
+Result measure_program(const Settings &settings, const string &program,
+                       const string &path, size_t rows);
+
+// Prints the results of a benchmark
+void report(const Result &result, bool tsv);
+
+// Size of a file, or 0 if it does not exist
+size_t file_size(const string &path);
+
+// Copies a file, replacing the target
+bool copy_file(const string &from, const string &to);
+
+// Prints the command line options of the benchmark
+void print_bench_usage(const char *program);
+
+// Words titles and descriptions are made of
+const char *const WORDS[] = {
+    "review", "update", "report", "meeting", "client", "budget", "draft",
+    "email", "call", "prepare", "slides", "team", "quarterly", "numbers",
+    "invoice", "contract", "schedule", "follow", "up", "with", "the", "and",
+    "for", "on", "about", "project", "release", "notes", "fix", "bug",
+    "deploy", "server", "backup", "order", "supplies", "book", "flight",
+    "hotel", "renew", "licence", "plan", "sprint", "design", "document",
+    "interview", "candidate", "onboarding", "training", "survey", "results",
+    "weekly", "sync", "roadmap", "customer", "feedback", "pay", "rent",
+    "groceries", "dentist", "birthday", "gift", "clean", "garage", "taxes",
+};
+
+// Text that needs care when saved or parsed
+const char *const EDGE_CASES[] = {
+    "\"urgent\"", "see \"notes\", page 2", "a, b, c", "line one\nline two",
+    "caf\xC3\xA9 \xE2\x9C\x93", "\"\"", " leading and trailing ", "50% done",
+};
+
+int main(int argc, char *argv[])
+{
+    Settings settings;
+    string rows_option = BENCH_ROWS;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string option = argv[i];
+        if (option == "--tsv")
+        {
+            settings.tsv = true;
+            continue;
+        }
+
+        // All other options take a value
+        if (i + 1 == argc)
+        {
+            print_bench_usage(argv[0]);
+            return 1;
+        }
+
+        if (option == "--rows")
+            rows_option = argv[++i];
+        else if (option == "--repeat")
+        {
+            if (!parse_number(argv[++i], settings.repeat) || settings.repeat == 0)
+            {
+                print_bench_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (option == "--dir")
+            settings.directory = argv[++i];
+        else if (option == "--program")
+            settings.programs.push_back(argv[++i]);
+        else
+        {
+            print_bench_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Comma-separated sizes
+    stringstream list(rows_option);
+    string size;
+    while (getline(list, size, ','))
+    {
+        size_t rows;
+        if (!parse_number(size, rows) || rows == 0)
+        {
+            print_bench_usage(argv[0]);
+            return 1;
+        }
+        settings.rows.push_back(rows);
+    }
+    if (settings.rows.empty())
+    {
+        print_bench_usage(argv[0]);
+        return 1;
+    }
+
+#ifdef __MINGW32__
+    _mkdir(settings.directory.c_str());
+#else
+    mkdir(settings.directory.c_str(), 0755);
+#endif
+
+    // Output of the print benchmarks goes nowhere
+#ifdef __MINGW32__
+    ofstream null_output("NUL");
+#else
+    ofstream null_output("/dev/null");
+#endif
+
+    if (settings.tsv)
+        cout << "rows\tbenchmark\tmin_ms\tmedian_ms\titems_per_s\tmb_per_s\n";
+    else
+        cout << left << setw(10) << "Rows" << setw(26) << "Benchmark" << right
+             << setw(12) << "Min ms" << setw(12) << "Median ms" << "  Throughput\n";
+
+    for (size_t rows : settings.rows)
+    {
+        string csv_path = settings.directory + "/bench-" + to_string(rows) + ".csv";
+        string snapshot_path = settings.directory + "/bench-" + to_string(rows) + ".snap";
+        string output_path = settings.directory + "/output.tmp";
+
+        // Data sets are generated once and reused by later runs
+        if (file_size(csv_path) == 0)
+        {
+            cerr << "Generating " << csv_path << " ..." << endl;
+            if (!generate_save_file(csv_path, rows, BENCH_SEED))
+            {
+                cerr << "Cannot write " << csv_path << endl;
+                return 1;
+            }
+        }
+        if (file_size(snapshot_path) == 0)
+        {
+            load_list(csv_path);
+            save_format = FORMAT_BINARY;
+            data_path = snapshot_path;
+            todo_items_dirty = true;
+            save_data();
+        }
+
+        vector<Result> results;
+        Result result;
+
+        // Loading, with the file already in the page cache
+        result = Result{"retrieve_data csv", rows, rows, file_size(csv_path)};
+        load_list(csv_path);
+        measure(result, settings.repeat, [&] { reset_list(); data_path = csv_path; },
+                [] { todo_items = retrieve_data(); });
+        results.push_back(result);
+
+        result = Result{"retrieve_data binary", rows, rows, file_size(snapshot_path)};
+        load_list(snapshot_path);
+        measure(result, settings.repeat, [&] { reset_list(); data_path = snapshot_path; },
+                [] { todo_items = retrieve_data(); });
+        results.push_back(result);
+
+        result = Result{"index_tasks", rows, rows};
+        measure(result, settings.repeat, [] {}, [] { index_tasks(); });
+        results.push_back(result);
+
+        // Saving writes a temporary file and renames it, as the program does
+        load_list(csv_path);
+        data_path = output_path;
+        for (SaveFormat format : {FORMAT_CSV, FORMAT_BINARY})
+        {
+            result = Result{format == FORMAT_CSV ? "save_data csv" : "save_data binary", rows, rows};
+            measure(result, settings.repeat, [&] { save_format = format; todo_items_dirty = true; },
+                    [] { save_data(); });
+            result.bytes = file_size(output_path);
+            results.push_back(result);
+        }
+
+        // A single mark is patched into the CSV file, at a cost
+        // that should not depend on the size of the list
+        save_format = FORMAT_CSV;
+        todo_items_dirty = true;
+        save_data();
+        journal_path = output_path + JOURNAL_SUFFIX;
+        journal.open(journal_path.c_str(), save_file_hash, 0);
+        journal.reset(save_file_hash);
+        result = Result{"save_data csv patch", rows, 1};
+        measure(result, settings.repeat, [] {
+            todo_items.set_completed(0, !todo_items.completed(0));
+            mark_dirty(0, false);
+            todo_items_dirty = true;
+        }, [] { save_data(); });
+        results.push_back(result);
+        journal.close();
+        ::remove(journal_path.c_str());
+        ::remove(output_path.c_str());
+
+        // Printing, the whole list and sorted
+        load_list(csv_path);
+        result = Result{"view", rows, rows};
+        measure(result, settings.repeat, [] {},
+                [&] { print_tasks(null_output, todo_items); null_output.flush(); });
+        results.push_back(result);
+
+        vector<string> sorted_view = {"view", "--sort", "completed,due,title"};
+        result = Result{"view --sort", rows, rows};
+        measure(result, settings.repeat, [] { sort_cache.version = UINT64_MAX; },
+                [&] { run_command(sorted_view, null_output, cerr); null_output.flush(); });
+        results.push_back(result);
+
+        vector<string> stats = {"stats"};
+        result = Result{"stats", rows, rows};
+        measure(result, settings.repeat, [] {},
+                [&] { run_command(stats, null_output, cerr); });
+        results.push_back(result);
+
+        measure_changes(settings, csv_path, rows, results);
+        reset_list();
+
+        for (const string &program : settings.programs)
+            results.push_back(measure_program(settings, program, csv_path, rows));
+
+        for (const Result &done : results)
+            report(done, settings.tsv);
+    }
+
+    return 0;
+}
+
+bool generate_save_file(const string &path, size_t rows, uint64_t seed)
+{
+    ofstream out(path, ios::out | ios::binary);
+    if (!out)
+        return false;
+
+    Random random(seed);
+    string title, description;
+
+    // Appends words up to a number of characters, with
+    // an occasional piece of text that needs escaping
+    auto fill = [&random](string &text, size_t length, double edge_chance) {
+        text.clear();
+        while (text.size() < length)
+        {
+            if (!text.empty())
+                text += ' ';
+            if (random.chance(edge_chance))
+                text += EDGE_CASES[random.below(size(EDGE_CASES))];
+            else
+                text += WORDS[random.below(size(WORDS))];
+        }
+    };
+
+    // Due dates between 2020 and 2030
+    int32_t first_day = days_from_civil(2020, 1, 1);
+    int32_t last_day = days_from_civil(2030, 12, 31);
+
+    for (size_t i = 0; i < rows; i++)
+    {
+        // Titles of a few words, descriptions of up to a few sentences
+        fill(title, 10 + random.below(50), 3);
+        if (random.chance(20))
+            description.clear();
+        else
+            fill(description, random.below(200), 2);
+
+        TodoItem task;
+        task.title = Text::borrow(title);
+        task.description = Text::borrow(description);
+        task.due_date = random.chance(5) ? NO_DUE_DATE
+                                         : first_day + (int32_t)random.below(last_day - first_day + 1);
+        task.completed = random.chance(30);
+        task.id = random.chance(1) ? NO_TASK_ID : i + 1;
+        write_csv_task(out, task);
+    }
+
+    out.close();
+    return !out.fail();
+}
+
+void reset_list()
+{
+    // The previous state is dropped along with the list it is swapped into
+    TodoList empty;
+    swap_active_list(empty);
+    data_path = DATA_PATH;
+    journal_path = JOURNAL_PATH;
+}
+
+void load_list(const string &path)
+{
+    reset_list();
+    data_path = path;
+    journal_path = path + JOURNAL_SUFFIX;
+    todo_items = retrieve_data();
+    index_tasks();
+}
+
+template <class Prepare, class Run>
+void measure(Result &result, size_t repeat, Prepare prepare, Run run)
+{
+    for (size_t i = 0; i < repeat; i++)
+    {
+        prepare();
+        auto start = chrono::steady_clock::now();
+        run();
+        auto stop = chrono::steady_clock::now();
+        result.times.push_back(chrono::duration<double, milli>(stop - start).count());
+    }
+}
+
+void measure_changes(const Settings &settings, const string &path, size_t rows,
+                     vector<Result> &results)
+{
+    size_t changes = min(rows, (size_t)BENCH_CHANGES);
+    Result add = {"add", rows, changes};
+    Result mark = {"mark", rows, changes};
+    Result edit = {"edit", rows, changes};
+    Result remove = {"remove", rows, changes};
+    Result mark_range = {"mark range", rows, 0};
+    Result remove_completed = {"remove --completed", rows, 0};
+
+    // Arguments are prepared up front, so that only the
+    // commands themselves are timed
+    vector<vector<string>> adds, marks, edits, removes;
+    for (size_t i = 0; i < changes; i++)
+        adds.push_back({"add", "--title", "Benchmark task " + to_string(i),
+                        "--desc", "Added by the benchmark", "--due", "1/1/2030"});
+
+    for (size_t run = 0; run < settings.repeat; run++)
+    {
+        // Changes of earlier runs are thrown away
+        load_list(path);
+        ::remove(journal_path.c_str());
+        open_journal();
+        journal.policy = FSYNC_NEVER;
+        defer_commits = true;
+
+        // Tasks spread over the whole list, each changed once
+        marks.clear();
+        edits.clear();
+        removes.clear();
+        for (size_t i = 0; i < changes; i++)
+        {
+            string id = to_string(todo_items.id(i * (todo_items.size() / changes)));
+            marks.push_back({"mark", id});
+            edits.push_back({"edit", id, "--title", "Edited by the benchmark", "--due", "2/2/2030"});
+            removes.push_back({"remove", id});
+        }
+
+        for (auto step : {make_pair(&add, &adds), make_pair(&mark, &marks),
+                          make_pair(&edit, &edits), make_pair(&remove, &removes)})
+        {
+            vector<vector<string>> &commands = *step.second;
+            measure(*step.first, 1, [] {}, [&commands] {
+                for (const vector<string> &args : commands)
+                    run_command(args, cout, cerr);
+                journal.commit();
+            });
+        }
+
+        // Bulk changes start over from the saved list, since the removes
+        // above take out every task of the smaller data sets: the first
+        // half of the IDs is marked and then every completed task is
+        // removed, one command each
+        journal.close();
+        load_list(path);
+        ::remove(journal_path.c_str());
+        open_journal();
+        journal.policy = FSYNC_NEVER;
+        vector<string> mark_all = {"mark", "1-" + to_string(next_task_id / 2)};
+        vector<string> remove_all = {"remove", "--completed"};
+        ostringstream output;
+        size_t completed = count_completed(todo_items);
+        measure(mark_range, 1, [] {}, [&] {
+            run_command(mark_all, output, cerr);
+            journal.commit();
+        });
+        mark_range.items = count_completed(todo_items) - completed;
+        remove_completed.items = count_completed(todo_items);
+        measure(remove_completed, 1, [] {}, [&] {
+            run_command(remove_all, output, cerr);
+            journal.commit();
+        });
+
+        journal.close();
+        ::remove(journal_path.c_str());
+        defer_commits = false;
+    }
+
+    for (Result *result : {&add, &mark, &edit, &remove, &mark_range, &remove_completed})
+        results.push_back(*result);
+}
+
+Result measure_program(const Settings &settings, const string &program,
+                       const string &path, size_t rows)
+{
+    Result result = {"startup " + program, rows, rows, file_size(path)};
+
+    // Programs run in a directory of their own, which
+    // they are started in through the shell
+    string directory = settings.directory + "/program";
+#ifdef __MINGW32__
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+    string save_path = directory + "/save.csv";
+    string input_path = directory + "/input.txt";
+
+    // Exit right away, then confirm the farewell message
+    ofstream input(input_path);
+    input << "6\n\n";
+    input.close();
+
+    // Paths have to survive changing into the directory
+    char cwd[4096];
+    string base = getcwd(cwd, sizeof(cwd)) != nullptr ? string(cwd) + "/" : "";
+    auto absolute = [&base](const string &p) { return p[0] == '/' ? p : base + p; };
+
+#ifdef __MINGW32__
+    string command = "cd /d \"" + directory + "\" && \"" + absolute(program) +
+                     "\" < input.txt > NUL 2>&1";
+#else
+    string command = "cd '" + directory + "' && '" + absolute(program) +
+                     "' < input.txt > /dev/null 2>&1";
+#endif
+
+    measure(result, settings.repeat,
+            [&] {
+                // Older builds rewrite the file on exit, so
+                // every run starts from a fresh copy
+                copy_file(path, save_path);
+                ::remove((save_path + JOURNAL_SUFFIX).c_str());
+            },
+            [&] {
+                if (system(command.c_str()) != 0)
+                    cerr << "Warning: " << program << " failed" << endl;
+            });
+
+    ::remove(save_path.c_str());
+    ::remove((save_path + JOURNAL_SUFFIX).c_str());
+    ::remove(input_path.c_str());
+    return result;
+}
+
+void report(const Result &result, bool tsv)
+{
+    vector<double> times = result.times;
+    sort(times.begin(), times.end());
+    double fastest = times.front();
+    double median = times[times.size() / 2];
+
+    // Throughput of the median run
+    double seconds = median / 1000;
+    double items_per_second = seconds > 0 ? result.items / seconds : 0;
+    double megabytes_per_second = seconds > 0 ? result.bytes / seconds / (1024 * 1024) : 0;
+
+    if (tsv)
+    {
+        cout << result.rows << '\t' << result.name << '\t' << fixed << setprecision(3)
+             << fastest << '\t' << median << '\t' << setprecision(0) << items_per_second
+             << '\t' << setprecision(1) << megabytes_per_second << '\n';
+        cout.unsetf(ios::floatfield);
+        return;
+    }
+
+    ostringstream throughput;
+    throughput << fixed << setprecision(2);
+    if (items_per_second >= 1e6)
+        throughput << items_per_second / 1e6 << "M/s";
+    else
+        throughput << items_per_second / 1e3 << "k/s";
+    if (result.bytes > 0)
+        throughput << ", " << setprecision(0) << megabytes_per_second << " MB/s";
+
+    cout << left << setw(10) << result.rows << setw(26) << result.name << right
+         << fixed << setprecision(2) << setw(12) << fastest << setw(12) << median
+         << "  " << throughput.str() << '\n';
+    cout.unsetf(ios::floatfield);
+}
+
+size_t file_size(const string &path)
+{
+    ifstream file(path, ios::binary | ios::ate);
+    return file ? (size_t)file.tellg() : 0;
+}
+
+bool copy_file(const string &from, const string &to)
+{
+    ifstream in(from, ios::binary);
+    ofstream out(to, ios::binary);
+    out << in.rdbuf();
+    out.close();
+    return in && !out.fail();
+}
+
+void print_bench_usage(const char *program)
+{
+    cerr << "Usage: " << program << " [options]" << endl
+         << endl
+         << "Options:" << endl
+         << "  --rows N,...         Sizes of the data sets, in tasks" << endl
+         << "                       (default: " << BENCH_ROWS << ")" << endl
+         << "  --repeat N           Timed runs of every benchmark (default: " << BENCH_REPEAT << ")" << endl
+         << "  --dir DIR            Directory to keep the generated save files in" << endl
+         << "                       (default: " << BENCH_DIRECTORY << ")" << endl
+         << "  --program PATH       Also time starting and leaving another build of" << endl
+         << "                       the program, may be given more than once" << endl
+         << "  --tsv                Print tab-separated values instead of a table" << endl;
+}
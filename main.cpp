@@ -3,7 +3,7 @@
  * existing tasks, mark tasks as completed, edit tasks and delete tasks. 
  * It also provides functionality to save tasks to a CSV (Comma Separated
  * Values) file and retrieve them upon restarting the application. This 
- * program features the use of regular expressions for data extraction 
+ * program features a hand-written streaming CSV parser for data extraction
  * and validation, along with utilisation of the CSV file format for 
  * data storage to ensure the reusability of program. Additionally, this 
  * program is designed to be cross-platform, with the ability to run on both 
@@ -13,634 +13,9527 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <climits>
 #include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
 #include <vector>
-#include <regex>
+#include <array>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string_view>
+#include <charconv>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <type_traits>
 
-using namespace std;
-
-// Platform specific commands
+// Platform specific headers
+#include <fcntl.h>
 #ifdef __MINGW32__ // Windows
-    #define CLEAR_SCREEN "cls"
+    #define NOMINMAX
+    #include <windows.h>
+    #include <io.h>
+    #include <direct.h>
+    #define fsync _commit
+    #define ftruncate _chsize
 #else // Linux or MacOS
-    #define CLEAR_SCREEN "clear"
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <dirent.h>
+    #include <unistd.h>
+    #define O_BINARY 0
+#endif
+#ifdef __linux__ // Server
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
+
+// Vector instructions used by the filter kernels
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#elif defined(__aarch64__)
+    #include <arm_neon.h>
 #endif
 
+using namespace std;
+
 // Path to save file
 #define DATA_PATH "./save.csv"
 
+// Size of each block read from the save file while parsing
+#define CSV_BLOCK_SIZE (64 * 1024)
+
+// Bytes of a CSV save file hashed together, so that patching the file
+// only has to hash the blocks it wrote to again
+#define CSV_HASH_BLOCK_SIZE (64 * 1024)
+
+// Smallest range of a CSV file worth parsing on a thread of its own
+#define CSV_THREAD_MIN_SIZE (1024 * 1024)
+
+// Smallest number of tasks worth sorting on a thread of its own
+#define SORT_THREAD_MIN_SIZE (64 * 1024)
+
+// Default number of tasks per page in command mode
+#define VIEW_PAGE_SIZE 20
+
+// Default number of tasks listed by the next command
+#define NEXT_COUNT 10
+
+// Number of days, starting today, that count as this week
+#define WEEK_DAYS 7
+
+// Size of the buffer collecting view output before it is written
+#define VIEW_BUFFER_SIZE (256 * 1024)
+
+// Binary snapshot format
+#define SNAPSHOT_MAGIC "TODOSNAP"       // First 8 bytes of every snapshot
+#define SNAPSHOT_VERSION 3              // Latest version of the layout
+#define SNAPSHOT_HEADER_SIZE 48         // Magic, version, flags, task count, next ID,
+                                        // table sizes, end of blocks
+#define SNAPSHOT_V2_HEADER_SIZE 32      // Header of version 2, without table sizes
+#define SNAPSHOT_V1_HEADER_SIZE 24      // Header of version 1, without next ID
+#define SNAPSHOT_BLOCK_ENTRY_SIZE 16    // Offset and checksum of a block
+#define SNAPSHOT_INDEX_ENTRY_SIZE 32    // Kind, offset, size and checksum of an index
+#define SNAPSHOT_INDEX_DUE 1            // Kind of the prebuilt `DueIndex`
+#define SNAPSHOT_DUE_ENTRY_SIZE 12      // Due date and ID of an entry of the due index
+#define SNAPSHOT_THREAD_MIN_BLOCKS 16   // Fewest blocks worth starting a thread for
+#define SNAPSHOT_TRAILER_SIZE 8         // Checksum of everything before it
+#define SNAPSHOT_BLOCK_SIZE 4096        // Maximum number of tasks per block
+#define SNAPSHOT_FLAG_STREAMED 1        // Task count and next ID are unknown
+#define SNAPSHOT_FLAG_INDEXED 2         // Header holds the block and index tables
+
+// Journal of changes made since the save file was last written
+#define JOURNAL_SUFFIX ".journal"       // Appended to the save file path
+#define JOURNAL_PATH DATA_PATH JOURNAL_SUFFIX
+#define JOURNAL_MAGIC "TODOJRNL"        // First 8 bytes of every journal
+#define JOURNAL_VERSION 2               // Latest version of the layout
+#define JOURNAL_HEADER_SIZE 24          // Magic, version, flags, base hash
+#define JOURNAL_FLAG_PATCHING 1         // Save file may hold some records already
+#define JOURNAL_FLAG_BLOCK_HASH 2       // Base hash of a CSV file is of its blocks
+#define JOURNAL_GROUP_SIZE (64 * 1024)  // Pending bytes that force a commit
+#define JOURNAL_SYNC_INTERVAL 1000      // Milliseconds between batched fsyncs
+#define JOURNAL_COMPACT_SIZE (1024 * 1024) // Minimum size before compaction
+#define ARCHIVE_SUFFIX ".archive"       // Appended to the save file path
+#define ARCHIVE_PATH DATA_PATH ARCHIVE_SUFFIX
+#define ARCHIVE_MAGIC "TODOARCH"        // First 8 bytes of every archive
+#define ARCHIVE_END_MAGIC "TODOAEND"    // Last 8 bytes of every archive
+#define ARCHIVE_VERSION 1               // Latest version of the layout
+#define ARCHIVE_HEADER_SIZE 16          // Magic, version, flags
+#define ARCHIVE_ENTRY_SIZE 44           // Block index entry, see `ArchiveBlock`
+#define ARCHIVE_TRAILER_SIZE 32         // Index offset, block count, checksum, next ID, magic
+#define ARCHIVE_BLOCK_TASKS 4096        // Maximum number of tasks per block
+#define ARCHIVE_AGE 30                  // Days past their due date completed tasks are archived
+#define LZ_HASH_BITS 14                 // Size of the match finder's hash table
+#define LZ_MIN_MATCH 4                  // Shortest match worth encoding
+#define LZ_MAX_OFFSET 65535             // Farthest back a match may start
+#define JOURNAL_QUEUE_SIZE 1024         // Groups the persistence thread can fall behind
+#define JOURNAL_COALESCE_INTERVAL 10    // Milliseconds records are gathered for
+
+// Due date of tasks whose date could not be understood
+#define NO_DUE_DATE INT32_MIN
+
+// ID of removed tasks, never given to a task
+#define NO_TASK_ID 0
+
+// Removed tasks left in todo_items before it is compacted
+#define TASK_COMPACT_MIN 1024
+
+// Size of each chunk of memory the text arena takes from the system
+#define TEXT_CHUNK_SIZE (1024 * 1024)
+
+// Maximum number of events kept for the Chrome trace
+#define TRACE_EVENT_LIMIT 1000000
+
+// Directory holding the save files of named lists
+#define LIST_DIRECTORY "./lists"
+
+// Name of the list kept in DATA_PATH
+#define DEFAULT_LIST "default"
+
+// Memory that loaded lists may take up before the least recently
+// used ones are unloaded, in megabytes
+#define LIST_MEMORY_BUDGET 256
+
+// Socket the server listens on, unless another is given
+#define SOCKET_PATH "./todolist.sock"
+
+// Largest request a client may send, in bytes
+#define SOCKET_REQUEST_LIMIT (16 * 1024 * 1024)
+
+// Maximum number of events handled per wait of the server
+#define SOCKET_EVENT_COUNT 64
+
+// Threads of the server answering queries on snapshots
+#define SOCKET_READER_COUNT 4
+
+// Formats the save file can be written in
+enum SaveFormat {
+    FORMAT_CSV,     // Quoted CSV text, one task per line
+    FORMAT_BINARY   // Binary snapshot, see `serialise_snapshot()`
+};
+
+// When journal records are forced to disk
+enum FsyncPolicy {
+    FSYNC_ALWAYS,   // After every commit
+    FSYNC_BATCH,    // At most every JOURNAL_SYNC_INTERVAL milliseconds
+    FSYNC_NEVER     // Left to the operating system
+};
+
+// Kinds of changes recorded in the journal
+enum ChangeType : uint8_t {
+    CHANGE_ADD = 1,
+    CHANGE_MARK,
+    CHANGE_EDIT,
+    CHANGE_REMOVE
+};
+
+// Bump allocator holding the characters of all text owned by tasks.
+// Memory is taken from the system in chunks of TEXT_CHUNK_SIZE and
+// given back all at once, rather than once per string.
+class TextArena {
+public:
+    // Copies characters into the arena
+    string_view store(string_view text);
+
+    // Number of bytes handed out so far
+    size_t used() const { return total; }
+
+    void swap(TextArena &other);
+
+    // Takes over all memory of another arena, which is left empty
+    void absorb(TextArena &other);
+
+    // Adds owners of every chunk so far, which keep the text in them
+    // alive after the arena lets go of it
+    void share(vector<shared_ptr<char[]>> &owners) const;
+
+private:
+    vector<shared_ptr<char[]>> chunks;
+    char *next = nullptr;   // Free space in the last chunk
+    size_t left = 0;
+    size_t total = 0;
+};
+
+// Text field of a task. Text read from the save file borrows its
+// characters from the memory-mapped file; any assigned text is
+// copied into `text_arena`.
+class Text {
+public:
+    Text() = default;
+    Text(string_view value);
+    Text(const string &value) : Text(string_view(value)) {}
+
+    // Creates text referring to characters owned by someone else
+    static Text borrow(string_view view);
+
+    // Characters of the text
+    string_view view() const { return characters; }
+
+    // Whether the characters still live in the save file mapping
+    bool borrows() const { return is_borrowed; }
+
+    // Copies borrowed characters into the text arena
+    void materialise();
+
+    // Copies characters owned by the text arena into another arena
+    void relocate(TextArena &arena);
+
+    bool empty() const { return characters.empty(); }
+
+private:
+    string_view characters;
+    bool is_borrowed = false;
+};
+
+ostream &operator<<(ostream &out, const Text &text);
+
 // Single item unit
 struct TodoItem {
-    string title;
-    string description;
-    string due_date;
+    Text title;
+    Text description;
+    int32_t due_date = NO_DUE_DATE; // Days since 1 January 1970
     bool completed = false;
+    uint64_t id = NO_TASK_ID;       // Stable, NO_TASK_ID once removed
+
+    bool is_removed() const { return id == NO_TASK_ID; }
 };
 
-// List containing item units
-typedef vector<TodoItem> TodoItems;
+// Read-only view of a whole file. The file is memory-mapped so
+// that its contents are paged in on demand instead of being copied.
+// Files that cannot be mapped are read into memory in a single read.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
 
-// Function declarations
-// Main command functions
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
 
-/**
- *  @brief Adds a new task to the to-do list.
- *  
- *  This function prompts the user to enter details for a new task,
- *  including the title, description, and due date. If the user
- *  provides valid input, the task is added to the `todo_items` vector.
- */
-void add();
+    /**
+     *  @brief Maps a file into memory.
+     *
+     *  @param path Path of the file to map.
+     *  @return `true` if the file was opened, `false` if otherwise.
+     */
+    bool open(const char *path);
 
-/**
- *  @brief Displays all tasks in the to-do list.
- * 
- *  This function iterates through the `todo_items` vector and prints
- *  the detail of each task, including the title, description, due date,
- *  status of completion.
- */
-void view();
+    /**
+     *  @brief Reads a file into memory with a single read.
+     *
+     *  @param path Path of the file to read.
+     *  @return `true` if the file was read, `false` if otherwise.
+     */
+    bool read(const char *path);
 
-/**
- *  @brief Marks a task as completed.
- *  
- *  This function prompts the user to select a task by its position in
- *  the `todo_items` vector. If the task is not already marked as completed,
- *  it sets the task's `completed` attribute to true.
- */
-void mark();
+    // Unmaps the file. Pointers into the mapping become invalid.
+    void close();
 
-/**
- *  @brief Edits an existing task in the to-do list.
- * 
- *  This function prompts the user to select a task by its position in the
- *  `todo_items` vector and then allows the user to modify the task's title, 
- *  description, and due date. The task is updated with the new details.
- */
-void edit();
+    bool is_open() const { return opened; }
+    const char *data() const { return base; }
+    size_t size() const { return length; }
 
-/**
- *  @brief Removes a task from the to-do list.
- *  
- *  This function prompts the user to select a task by its position in
- *  the `todo_items` vector and confirms the deletion. If confirmed, the task
- *  is removed from the vector.
- */
-void remove();
+private:
+    const char *base = nullptr;
+    size_t length = 0;
+    bool opened = false;
+    bool mapped = false;    // Whether base points to a mapping
+    vector<char> contents;  // File contents if they were read instead
+#ifdef __MINGW32__
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif
+};
 
-// Tools
+// List containing item units, stored column by column so that scans
+// over a single field, such as counting incomplete tasks, only read
+// that field. Completion states are packed into a bitset. Removed
+// tasks keep their place until the list is compacted, with no ID, no
+// text, no due date and not completed.
+class TaskStore {
+public:
+    size_t size() const { return ids.size(); }
 
-/**
- *  @brief Gets the position of a task in the to-do list.
- * 
- *  This function prompts the user to enter the number of task they want to
- *  interact with. It validates the input and returns the zero-based index of
- *  the task in the `todo_items` vector.
- * 
- *  @param action A string indicating the action being performed (e.g., "edit").
- *  @return The zero-based index of the task in the vector, or -1 if the
- *  operation is aborted.
- */
-int get_item_position(string action);
+    // Number of tasks that were not removed
+    size_t live_count() const { return ids.size() - removed; }
 
-/**
- *  @brief Checks if a year is a leap year.
- * 
- *  This function determines if the given year is a leap year based on the
- *  standard leap year rules.
- * 
- *  @param year The year to check.
- *  @return `true` if the year is a leap year, `false` if otherwise.
- */
-bool is_leap_year(int year);
+    // Number of removed tasks still taking up room
+    size_t removed_count() const { return removed; }
 
-/**
- *  @brief Validates a date string.
- * 
- *  This function checks if the given date string is in the format DD/MM/YYYY
- *  and represents a valid date.
- * 
- *  @param date_str The date string to validate.
- *  @return `true` if the date is valid, `false` if otherwise.
- */
-bool is_valid_date(string);
+    void reserve(size_t count);
 
-/**
- *  @brief Prompts the user for a valid date input.
- * 
- *  This function continuously prompts the user to enter a date until a valid
- *  date in the format DD/MM/YYYY is provided.
- * 
- *  @return A valid date string in the format DD/MM/YYYY.
- */
-string get_date_input();
+    // Adds tasks with no ID, no text, no due date, not completed
+    void resize(size_t count);
 
-// File IO functions
+    // Adds a task at the end
+    void push_back(const TodoItem &task);
 
-/**
- *  @brief Saves the current tasks to save file.
- * 
- *  This function writes all tasks in the `todo_items` vector to a CSV file
- *  specified by `DATA_PATH` constant. Each task is saved in a single line
- *  with fields enclosed in quotes.
- */
-void save_data();
+    // Adds all tasks of another store at the end
+    void append(const TaskStore &other);
 
-/**
- *  @brief Retrieves tasks from a file.
- * 
- *  This function reads tasks from the program save file specified by 
- *  `DATA_PATH` constant and loads them into the `todo_items` vector. Each 
- *  line in the file is parsed to extract task details.
- *  
- *  @return A vector of `TodoItem` containing all tasks read from the file.
- */
-TodoItems retrieve_data();
+    // Copy of all fields of a task
+    TodoItem operator[](size_t index) const;
 
-// Global storage object
-TodoItems todo_items;
+    uint64_t id(size_t index) const { return ids[index]; }
+    bool is_removed(size_t index) const { return ids[index] == NO_TASK_ID; }
+    const Text &title(size_t index) const { return titles[index]; }
+    Text &title(size_t index) { return titles[index]; }
+    const Text &description(size_t index) const { return descriptions[index]; }
+    Text &description(size_t index) { return descriptions[index]; }
+    int32_t due_date(size_t index) const { return due_dates[index]; }
+    bool completed(size_t index) const { return (completed_bits[index / 64] >> (index % 64)) & 1; }
 
-// Main program loop
-int main() 
-{
-    char command;
-    // Retrieve saved data from previous run, if any
-    todo_items = retrieve_data();
+    void set_id(size_t index, uint64_t id) { ids[index] = id; }
+    void set_due_date(size_t index, int32_t date) { due_dates[index] = date; }
+    void set_completed(size_t index, bool value);
 
-    // Clear screen on first run
-    system(CLEAR_SCREEN);
+    // Clears a task and leaves it in place as removed
+    void remove(size_t index);
 
-    while (true)
-    {
-        // Show instructions
-        cout << "-To Do List-" << endl;
-        cout << "1. Add Task" << endl;
-        cout << "2. View Tasks" << endl;
-        cout << "3. Mark Task as Completed" << endl;
-        cout << "4. Edit Task" << endl;
-        cout << "5. Delete Task" << endl;
-        cout << "6. Exit" << endl << endl;
+    // Drops removed tasks, keeping the order of the others
+    void compact();
 
-        cout << "Enter a number 1-6: ";
+    // Columns, for scans over a whole field. Tasks are grouped into
+    // blocks of 64, each with one word of the completion bitset.
+    const int32_t *due_date_column() const { return due_dates.data(); }
+    const uint64_t *completed_column() const { return completed_bits.data(); }
+    size_t block_count() const { return completed_bits.size(); }
 
-        while (true)
-        {
-            cin >> command;
-            // Flush stdin stream to remove input "residue".
-            // Only first character will be read, the rest 
-            // of the line will be discarded.
-            cin.ignore(INT_MAX, '\n');
-            if (command >= '1' && command <= '6')
-                break;
-            cout << "Invalid input. Please enter a number within range 1-6: ";
-        }
+private:
+    vector<uint64_t> ids;
+    vector<Text> titles;
+    vector<Text> descriptions;
+    vector<int32_t> due_dates;
+    vector<uint64_t> completed_bits;  // Bit i % 64 of word i / 64
+    size_t removed = 0;
+};
 
-        cout << endl;
+// Task schema. Every field of a task is listed once in `task_schema`,
+// in the order of the fields of a CSV record, along with the codec that
+// reads and writes its values. The CSV, JSON Lines and snapshot codecs
+// are generated from the schema at compile time, so a new field only
+// takes a member of `TodoItem`, a column of `TaskStore` bound through
+// `TaskColumn`, and an entry in the schema.
 
-        system(CLEAR_SCREEN);
+struct CsvField;
 
-        // Map commands to main function calls
-        switch (command)
-        {
-            case '1':
-                add();
-                break;
-            case '2':
-                view();
-                break;
-            case '3':
-                mark();
-                break;
-            case '4':
-                edit();
-                break;
-            case '5':
-                remove();
-                break;
-            case '6':
-                // Save all data before program termination
-                save_data();
+// Parts of a snapshot block, each holding the values of the fields of
+// one kind for all tasks of the block. Parts follow in this order.
+enum SnapshotSection {
+    SECTION_IDS,    // 64-bit numbers, one column per field
+    SECTION_TEXT,   // String table, with all text fields of a task together
+    SECTION_WORDS,  // 32-bit numbers, one column per field
+    SECTION_BITS    // One bitset per field
+};
 
-                // Closure of application
-                cout << "Thanks for using the application, have a nice day!" << endl;
-                cout << "Press enter to exit ...";
-                cin.ignore(INT_MAX, '\n');
+// Codecs of the kinds of task fields. Every codec writes and reads its
+// values in CSV records and JSON Lines; snapshot numbers are written with
+// `put` and read with `get`. Values that are `is_unset` are left out of
+// JSON objects.
+struct TextCodec {
+    static constexpr SnapshotSection section = SECTION_TEXT;
 
-                // Cleanup
-                system(CLEAR_SCREEN);
+    static void write_csv(ostream &out, const Text &value);
+    static void read_csv(const CsvField &field, Text &value, bool borrow, string *unescaped);
+    static void write_json(string &out, const Text &value);
+    static bool read_json(const char *&p, const char *end, Text &value, string &unescaped);
+    static bool is_unset(const Text &) { return false; }
 
-                // Terminate program
-                return 0;
-        }
+    // Length-prefixed characters in the string table
+    static void put(string &out, const Text &value);
+};
 
-        // Allow user to read the output before the program continues
-        cout << "\nPress enter to continue ...";
-        cin.ignore(INT_MAX, '\n');
+struct DateCodec {
+    static constexpr SnapshotSection section = SECTION_WORDS;
+    static constexpr size_t width = 4;
 
-        // Remove clutter from previous output to improve readability
-        // and to focus on the next instructions
-        system(CLEAR_SCREEN);
-    }
+    static void write_csv(ostream &out, int32_t value);
+    static void read_csv(const CsvField &field, int32_t &value, bool borrow, string *unescaped);
+    static void write_json(string &out, int32_t value);
+    static bool read_json(const char *&p, const char *end, int32_t &value, string &unescaped);
+    static bool is_unset(int32_t) { return false; }
+
+    static void put(string &out, int32_t value);
+    static int32_t get(const char *p);
+};
+
+struct FlagCodec {
+    static constexpr SnapshotSection section = SECTION_BITS;
+
+    static void write_csv(ostream &out, bool value);
+    static void read_csv(const CsvField &field, bool &value, bool borrow, string *unescaped);
+    static void write_json(string &out, bool value);
+    static bool read_json(const char *&p, const char *end, bool &value, string &unescaped);
+    static bool is_unset(bool) { return false; }
+};
+
+struct IdCodec {
+    static constexpr SnapshotSection section = SECTION_IDS;
+    static constexpr size_t width = 8;
+
+    static void write_csv(ostream &out, uint64_t value);
+    static void read_csv(const CsvField &field, uint64_t &value, bool borrow, string *unescaped);
+    static void write_json(string &out, uint64_t value);
+    static bool read_json(const char *&p, const char *end, uint64_t &value, string &unescaped);
+    static bool is_unset(uint64_t value) { return value == NO_TASK_ID; }
+
+    static void put(string &out, uint64_t value);
+    static uint64_t get(const char *p);
+};
+
+// Entry of the task schema, for the member `Member` of `TodoItem`
+template <auto Member, typename Codec>
+struct TaskField {
+    using codec = Codec;
+    static constexpr auto member = Member;
+
+    const char *name;   // Key of the field in JSON Lines
+    uint32_t since;     // Snapshot version that added the field. CSV
+                        // records may lack fields added after version 1.
+    bool required;      // Whether JSON objects have to hold the field
+
+    static auto &of(TodoItem &task) { return task.*Member; }
+    static const auto &of(const TodoItem &task) { return task.*Member; }
+};
+
+constexpr auto task_schema = make_tuple(
+    TaskField<&TodoItem::title, TextCodec>{"title", 1, true},
+    TaskField<&TodoItem::description, TextCodec>{"description", 1, false},
+    TaskField<&TodoItem::due_date, DateCodec>{"due", 1, false},
+    TaskField<&TodoItem::completed, FlagCodec>{"completed", 1, false},
+    TaskField<&TodoItem::id, IdCodec>{"id", 2, false});
+
+// Number of fields stored per task in the save file
+constexpr size_t TASK_FIELD_COUNT = tuple_size_v<decltype(task_schema)>;
+
+template <typename Field>
+using codec_of = typename decay_t<Field>::codec;
+
+// Calls `visit(field, index)` for every field of the schema in order,
+// with the index as a compile-time constant
+template <typename Visit, size_t... I>
+void visit_fields(Visit &visit, index_sequence<I...>)
+{
+    (visit(get<I>(task_schema), integral_constant<size_t, I>()), ...);
 }
 
-void add()
+template <typename Visit>
+void for_each_field(Visit &&visit)
 {
-    // Create object to store new task details
-    TodoItem task;
+    visit_fields(visit, make_index_sequence<TASK_FIELD_COUNT>());
+}
 
-    cout << "Enter task details (Empty to abort operation): " << endl;
+// Calls `visit(field, index)` for the fields of the schema in order,
+// until it returns `true` for one of them
+template <typename Visit, size_t... I>
+bool find_field(Visit &visit, index_sequence<I...>)
+{
+    return (visit(get<I>(task_schema), integral_constant<size_t, I>()) || ...);
+}
 
-    // Title of new task
-    cout << "Title: ";
-    getline(cin, task.title);
+template <typename Visit>
+bool find_field(Visit &&visit)
+{
+    return find_field(visit, make_index_sequence<TASK_FIELD_COUNT>());
+}
 
-    // Allow user to back out of operation if they no longer 
-    // wish to continue
-    if (task.title.empty())
-    {
-        cout << "Abort task." << endl;
-        return;
-    }
+// Number of fields that snapshots of a version hold
+template <size_t... I>
+constexpr size_t fields_since(uint32_t version, index_sequence<I...>)
+{
+    return ((get<I>(task_schema).since <= version ? 1 : 0) + ... + 0);
+}
 
-    // Description of new task
-    cout << "Description: ";
-    getline(cin, task.description);
+// Whether fields added later come after all fields added before them
+template <size_t... I>
+constexpr bool fields_in_order(index_sequence<I...>)
+{
+    uint32_t since[] = { get<I>(task_schema).since... };
+    for (size_t i = 1; i < sizeof...(I); i++)
+        if (since[i] < since[i - 1])
+            return false;
+    return true;
+}
 
-    // Due date of new task
-    cout << "Due Date (DD/MM/YYYY): ";
-    task.due_date = get_date_input();
+// Fields every CSV record has to hold. Files written before
+// tasks had IDs lack the fields added since.
+constexpr size_t CSV_REQUIRED_FIELDS = fields_since(1, make_index_sequence<TASK_FIELD_COUNT>());
+
+static_assert(fields_in_order(make_index_sequence<TASK_FIELD_COUNT>()),
+              "CSV records can only leave out the last fields");
+
+// Column of `TaskStore` holding a field of the schema
+template <auto Member>
+struct TaskColumn;
+
+template <>
+struct TaskColumn<&TodoItem::title> {
+    static const Text &get(const TaskStore &items, size_t index) { return items.title(index); }
+    static void set(TaskStore &items, size_t index, const Text &value) { items.title(index) = value; }
+};
+
+template <>
+struct TaskColumn<&TodoItem::description> {
+    static const Text &get(const TaskStore &items, size_t index) { return items.description(index); }
+    static void set(TaskStore &items, size_t index, const Text &value) { items.description(index) = value; }
+};
+
+template <>
+struct TaskColumn<&TodoItem::due_date> {
+    static int32_t get(const TaskStore &items, size_t index) { return items.due_date(index); }
+    static void set(TaskStore &items, size_t index, int32_t value) { items.set_due_date(index, value); }
+};
+
+template <>
+struct TaskColumn<&TodoItem::completed> {
+    static bool get(const TaskStore &items, size_t index) { return items.completed(index); }
+    static void set(TaskStore &items, size_t index, bool value) { items.set_completed(index, value); }
+};
+
+template <>
+struct TaskColumn<&TodoItem::id> {
+    static uint64_t get(const TaskStore &items, size_t index) { return items.id(index); }
+    static void set(TaskStore &items, size_t index, uint64_t value) { items.set_id(index, value); }
+};
+
+// Value of a field of a task, for codecs generated from the schema
+template <typename Field>
+decltype(auto) field_value(const Field &, const TaskStore &items, size_t index)
+{
+    return TaskColumn<Field::member>::get(items, index);
+}
+
+template <typename Field>
+decltype(auto) field_value(const Field &field, const vector<TodoItem> &tasks, size_t index)
+{
+    return field.of(tasks[index]);
+}
+
+// Snapshot held in memory, read by `get_snapshot_block()`
+struct SnapshotBytes {
+    const char *p;
+    const char *end;
+
+    // Next bytes of the snapshot, or nullptr if it ends before them
+    const char *take(size_t size);
+
+    // Next bytes as text referring to the snapshot
+    bool text(size_t size, Text &value);
+};
+
+// Hash table from task IDs to the index of the task in todo_items.
+// Uses open addressing with linear probing. Removal moves later
+// entries of a probe sequence back, so that no markers are left
+// behind to slow down lookups.
+class TaskTable {
+public:
+    // Returned by find() for IDs that are not in the table
+    static const uint32_t npos = UINT32_MAX;
+
+    // Removes all entries
+    void clear();
+
+    // Makes room for a number of entries without rehashing
+    void reserve(size_t size);
+
+    // Index of the task with an ID, or npos
+    uint32_t find(uint64_t id) const;
+
+    // Adds an ID, unless it is in the table already
+    bool insert(uint64_t id, uint32_t index);
+
+    // Removes an ID, if it is in the table
+    void erase(uint64_t id);
+
+private:
+    struct Entry {
+        uint64_t id = NO_TASK_ID;   // NO_TASK_ID marks empty entries
+        uint32_t index = 0;
+    };
+
+    // First entry to probe for an ID
+    size_t home(uint64_t id) const;
+
+    vector<Entry> entries;  // Size is zero or a power of two
+    size_t count = 0;
+};
+
+// Position of each task field within a CSV record and `task_schema`
+enum CsvFieldIndex {
+    FIELD_TITLE,
+    FIELD_DESCRIPTION,
+    FIELD_DUE_DATE,
+    FIELD_COMPLETED,
+    FIELD_ID
+};
+
+static_assert(TASK_FIELD_COUNT == FIELD_ID + 1, "Every field of the schema has a position");
+
+// Outcome of scanning the input for a single CSV record
+enum CsvStatus {
+    CSV_RECORD,     // A complete record was read
+    CSV_BLANK,      // An empty line was skipped
+    CSV_MALFORMED,  // A line could not be parsed and was skipped
+    CSV_INCOMPLETE, // More input is required to finish the record
+    CSV_END         // No more input is available
+};
+
+// Single field of a CSV record, pointing into the parser's buffer.
+// Quotes around the field are not included. `escaped` is set when
+// the field contains doubled quotes ("") that have to be collapsed.
+struct CsvField {
+    const char *data;
+    size_t size;
+    bool escaped;
+};
+
+// Fields of a single CSV record
+struct CsvRecord {
+    CsvField fields[TASK_FIELD_COUNT];
+    size_t count;
+};
+
+// Where the records of the tasks are in a CSV save file, so that marks
+// and edits which keep every field at its size can be written into the
+// file in place instead of rewriting it. Offsets are only valid while
+// no task was added or removed since the file was loaded or written.
+struct CsvLayout {
+    vector<uint64_t> offsets;   // Start of the record of each task
+    vector<uint64_t> hashes;    // Hash of every CSV_HASH_BLOCK_SIZE bytes
+    vector<uint32_t> dirty;     // Tasks marked or edited since
+    bool edited = false;        // Whether text of any task changed
+    bool valid = false;
+};
+
+// Single change to the to-do list
+struct Change {
+    ChangeType type;
+    uint64_t id = NO_TASK_ID;   // Task added, marked, edited or removed
+    TodoItem item;              // New task details for add and edit
+};
+
+// Append-only log of the changes made since the save file was last
+// written. Records are collected and written in groups, and forced to
+// disk according to `policy`. Each record starts with the length and
+// checksum of its payload, so that a torn write at the end of the file
+// can be detected.
+class Journal {
+public:
+    ~Journal() { close(); }
+
+    /**
+     *  @brief Opens the journal for appending.
+     *
+     *  @param path Path of the journal file.
+     *  @param base_hash Hash of the save file the journal applies to.
+     *  @param valid_size Size of the intact part of an existing journal
+     *  for the same save file, or 0 to start an empty journal.
+     *  @return `true` if the journal was opened, `false` if otherwise.
+     */
+    bool open(const char *path, uint64_t base_hash, size_t valid_size);
+
+    // Adds a change to the group of pending records
+    void append(const Change &change);
+
+    // Writes pending records and syncs them according to the policy
+    bool commit();
+
+    // Forces all written records to disk
+    bool sync();
+
+    // Discards all records, after they were folded into the save file
+    bool reset(uint64_t base_hash);
+
+    // Flags the records as applying to the save file whatever its hash,
+    // before the file is patched with them; reset() clears the flag
+    bool begin_patch();
+
+    void close();
+
+    // Exchanges files and pending records with another journal
+    void swap(Journal &other);
+
+    // Size of the journal, including pending records
+    size_t size() const { return written + pending.size(); }
+
+    FsyncPolicy policy = FSYNC_ALWAYS;
+
+private:
+    // Creates an empty journal file holding just the header
+    bool create();
+
+    int fd = -1;
+    string path;
+    uint64_t base_hash = 0; // Hash of the save file the records apply to
+    string pending;         // Records not written yet
+    size_t written = 0;     // Bytes in the journal file
+    bool unsynced = false;  // Whether written bytes may not be on disk
+    chrono::steady_clock::time_point last_sync;
+};
+
+// Persistence thread writing journal records in the background, so that
+// commands of the interactive loop never wait on the disk. Groups of
+// records arrive through a lock-free ring with a single producer and a
+// single consumer. The thread gathers them for up to
+// JOURNAL_COALESCE_INTERVAL milliseconds or JOURNAL_GROUP_SIZE bytes,
+// writes them at once and forces them to disk according to the policy
+// of their journal. Journals write by themselves while it is not running.
+class JournalWriter {
+public:
+    ~JournalWriter() { stop(); }
+
+    void start();
+
+    // Writes everything queued and ends the thread
+    void stop();
+
+    bool running() const { return worker.joinable(); }
+
+    // Queues bytes to append to a journal file, forced to disk right
+    // after they are written if `sync` is set
+    void push(int fd, string bytes, FsyncPolicy policy, bool sync);
+
+    // Waits until everything queued so far is written
+    void drain();
+
+    // Whether a write failed since the last call
+    bool failed() { return failures.exchange(false); }
+
+private:
+    struct Write {
+        int fd = -1;
+        string bytes;
+        FsyncPolicy policy = FSYNC_ALWAYS;
+        bool sync = false;
+    };
+
+    void run();
+
+    array<Write, JOURNAL_QUEUE_SIZE> ring;
+    atomic<uint64_t> head{0};       // Next write taken by the thread
+    atomic<uint64_t> tail{0};       // Next write queued by the producer
+    uint64_t done = 0;              // Writes completed, guarded by `lock`
+    atomic<bool> idle{false};       // Whether the thread waits for writes
+    atomic<bool> urgent{false};     // Whether a drain waits for the writes
+    atomic<bool> stopping{false};
+    atomic<bool> failures{false};
+    mutex lock;
+    condition_variable wake, finished;
+    thread worker;
+};
+
+// Entry of the block index of an archive
+struct ArchiveBlock {
+    uint64_t offset = 0;    // Start of the compressed block in the file
+    uint32_t size = 0;      // Compressed size
+    uint32_t raw_size = 0;  // Size of the CSV text
+    uint32_t count = 0;     // Number of tasks
+    uint32_t batch = 0;     // Archive run that wrote the block, from 1
+    uint64_t first_id = 0;  // Smallest ID of the tasks
+    uint64_t last_id = 0;   // Largest ID of the tasks
+    uint32_t checksum = 0;  // Lower half of the FNV-1a hash of the block
+};
+
+// Completed tasks moved out of a list into a file of their own, so that
+// loading the list only reads open work. Tasks are stored as CSV text in
+// compressed blocks of up to ARCHIVE_BLOCK_TASKS tasks, followed by an
+// index of the blocks and a trailer, so that readers only decompress the
+// blocks they need. Archives are only opened by the commands reading
+// them, apart from the trailer, which tells the next free task ID.
+class Archive {
+public:
+    /**
+     *  @brief Maps an archive and reads its block index.
+     *
+     *  @param path Path of the archive.
+     *  @return `true` if the archive was read or does not exist, which
+     *  makes it empty, `false` if it is damaged.
+     */
+    bool open(const string &path);
+
+    const vector<ArchiveBlock> &blocks() const { return index; }
+
+    /**
+     *  @brief Decompresses a block and adds its tasks to a store.
+     *
+     *  Text of the tasks is stored in `thread_arena`.
+     *
+     *  @param block Position of the block in the index.
+     *  @param items Store to add the tasks to.
+     *  @return `true` if the block is intact, `false` if otherwise.
+     */
+    bool read(size_t block, TaskStore &items) const;
+
+    /**
+     *  @brief Writes the archive again with more tasks added.
+     *
+     *  Existing blocks are copied as they are, the tasks follow in new
+     *  blocks of the next batch, and the file is replaced atomically.
+     *  Tasks written by the last batch are not added again; they are
+     *  still in the list if the program stopped before removing them.
+     *
+     *  @param path Path of the archive, the one opened.
+     *  @param items Tasks to take the new tasks from.
+     *  @param positions Indexes of the new tasks in `items`.
+     *  @return `true` if the archive was written, `false` if otherwise.
+     */
+    bool append(const string &path, const TaskStore &items, const vector<uint32_t> &positions);
+
+    /**
+     *  @brief Reads the ID after the largest one in an archive.
+     *
+     *  Only the trailer is read.
+     *
+     *  @param path Path of the archive.
+     *  @return Next free task ID, or 0 if there is no readable archive.
+     */
+    static uint64_t next_id(const string &path);
+
+private:
+    MappedFile file;
+    vector<ArchiveBlock> index;
+    uint64_t next_task = 1;     // ID after the largest archived one
+};
+
+// Entry of the due date index
+struct DueEntry {
+    int32_t due_date;
+    uint64_t id;
+
+    bool operator<(const DueEntry &other) const
+    {
+        return due_date != other.due_date ? due_date < other.due_date
+                                          : id < other.id;
+    }
+};
+
+// Keys the task list can be sorted by
+enum SortKey {
+    SORT_DUE,       // Due date, tasks without one last
+    SORT_COMPLETED, // Incomplete tasks first
+    SORT_TITLE      // Title, ignoring the case of ASCII letters
+};
+
+// Order of the tasks in a store by a list of keys, compared by
+// index. Ties are broken by ID, so that the order is always the same.
+struct TaskOrder {
+    const TaskStore *items;
+    vector<SortKey> keys;
+
+    bool operator()(uint32_t a, uint32_t b) const;
+};
+
+// Order last computed by sort_tasks()
+struct SortCache {
+    vector<SortKey> keys;
+    uint64_t version = UINT64_MAX;
+    vector<uint32_t> order;
+};
+
+// Incomplete tasks that have a due date, sorted by due date and ID.
+// The index is built the first time it is needed and kept
+// in step with every change from then on; until then, updates are
+// ignored.
+class DueIndex {
+public:
+    // Builds the index from scratch, unless it is built already
+    void build(const TaskStore &items);
+
+    // Forgets the index, it is rebuilt when needed next
+    void clear() { entries.clear(); is_built = false; }
+
+    // Whether the index was built already
+    bool built() const { return is_built; }
+
+    // Adds a task, if it belongs into the index
+    void insert(const TodoItem &task);
+
+    // Removes a task, if it is in the index
+    void erase(const TodoItem &task);
+
+    // Removes many tasks in one pass, given their IDs in ascending order
+    void erase(const vector<uint64_t> &ids);
+
+    // Takes over entries in the order of the index, such as
+    // those saved with a snapshot, instead of building it
+    void adopt(vector<DueEntry> sorted);
+
+    // All entries, ordered by due date
+    const vector<DueEntry> &all() const { return entries; }
+
+    /**
+     *  @brief Finds the tasks due within a range of days.
+     *
+     *  @param from First day of the range.
+     *  @param to Day after the last day of the range.
+     *  @return Entries of the tasks, ordered by due date.
+     */
+    pair<vector<DueEntry>::const_iterator, vector<DueEntry>::const_iterator>
+    range(int32_t from, int32_t to) const;
+
+private:
+    vector<DueEntry> entries;
+    bool is_built = false;
+};
+
+// Inverted index from the words in titles and descriptions to the
+// tasks they appear in. Words are runs of letters and digits, compared
+// case-insensitively. Like DueIndex, the index is built on first use
+// and kept in step with every change from then on.
+class SearchIndex {
+public:
+    // Builds the index from scratch, unless it is built already
+    void build(const TaskStore &items);
+
+    // Forgets the index, it is rebuilt when needed next
+    void clear() { postings.clear(); is_built = false; }
+
+    // Adds the words of a task
+    void insert(const TodoItem &task);
+
+    // Removes the words of a task
+    void erase(const TodoItem &task);
+
+    // Removes many tasks in one pass, given their IDs in ascending order
+    void erase(const vector<uint64_t> &ids);
+
+    /**
+     *  @brief Finds the tasks that contain all words of a query.
+     *
+     *  Every word of the query matches the words it is a prefix of.
+     *
+     *  @param query Words to look for.
+     *  @return IDs of the matching tasks, in ascending order.
+     */
+    vector<uint64_t> find(string_view query) const;
+
+    /**
+     *  @brief Finds the same tasks as find(), reading every task instead.
+     *
+     *  @param items Tasks to look at.
+     *  @param query Words to look for.
+     *  @return IDs of the matching tasks, in ascending order.
+     */
+    static vector<uint64_t> scan(const TaskStore &items, string_view query);
+
+private:
+    // Collects the distinct, lower case words of a task
+    static void collect_words(const TodoItem &task, vector<string> &words);
+
+    // Appends the lower case words of a text, in order of appearance
+    static void split_words(string_view text, vector<string> &words);
+
+    // IDs of the tasks containing each word, in ascending order
+    map<string, vector<uint64_t>, less<>> postings;
+    bool is_built = false;
+};
+
+// Everything loaded for a list that is not the active one. The
+// active list lives in the globals below, so that the rest of the
+// program works on it without knowing about other lists; switching
+// lists exchanges the globals with one of these.
+struct TodoList {
+    TaskStore items;
+    TextArena arena;
+    bool dirty = false;
+    TaskTable slots;
+    uint64_t next_id = 1;
+    DueIndex due;
+    SearchIndex search;
+    uint64_t version = 0;
+    SortCache sorted;
+    shared_ptr<MappedFile> file = make_shared<MappedFile>();
+    SaveFormat format = FORMAT_CSV;
+    uint64_t file_hash = 0;
+    size_t file_size = 0;
+    CsvLayout layout;
+    Journal journal;
+    string data_path;
+    string journal_path;
+    string archive_path;
+    vector<pair<uint64_t, uint64_t>> changes;
+    uint64_t changes_start = 0;
+
+    uint64_t last_used = 0; // Value of list_clock when last active
+};
+
+// Copy of a list as it was at one version. Its tasks never change while
+// queries read it on other threads, so the list itself can go on
+// changing. Only the columns are copied; the text stays where it is,
+// kept alive by the snapshot's share of it. Once no query reads it any
+// more, a snapshot may be brought up to a later version of the list.
+struct ListSnapshot {
+    string list;            // Name of the list
+    uint64_t version = 0;   // Value of todo_items_version it holds
+    TaskStore items;
+    TaskTable slots;
+    DueIndex due;           // Copy of due_index, if it was built
+    vector<shared_ptr<char[]>> text;    // Chunks of text_arena
+    shared_ptr<MappedFile> file;        // Save file the text borrows from
+    mutex sort_lock;        // Held while sorting and reading the order
+    SortCache sorted;
+    string archive_path;    // Archive of the list, read by history and search
+};
+
+// Tasks a query reads, either those of the active list or a snapshot.
+// Indexes of the active list are built whenever needed. Snapshots are
+// searched without an index, since building one takes far longer
+// than reading every task once.
+struct ListView {
+    const TaskStore &items;
+    const TaskTable &slots;
+    DueIndex &due;
+    SearchIndex *search;        // nullptr to read every task instead
+    SortCache &sorted;
+    uint64_t version;
+    ListSnapshot *snapshot;     // nullptr for the active list
+    const string &archive_path;
+};
+
+// Streaming reader that splits an input stream into CSV records
+class CsvReader {
+public:
+    explicit CsvReader(istream &in);
+
+    /**
+     *  @brief Reads the next record from the stream.
+     *
+     *  Blank lines are skipped. The fields of `record` point into the
+     *  reader's internal buffer and stay valid until the next call.
+     *
+     *  @param record Record to fill with the fields that were read.
+     *  @return `CSV_RECORD`, `CSV_MALFORMED` or `CSV_END`.
+     */
+    CsvStatus next(CsvRecord &record);
+
+private:
+    istream &in;
+    vector<char> buffer;
+    size_t start = 0;   // First unconsumed byte in buffer
+    size_t filled = 0;  // Number of valid bytes in buffer
+    bool eof = false;
+};
+
+// Formats tasks can be exchanged in, one task at a time
+enum StreamFormat {
+    STREAM_CSV,         // Same layout as the CSV save file
+    STREAM_JSONL,       // One JSON object per line
+    STREAM_SNAPSHOT     // Same layout as the binary snapshot
+};
+
+// Streaming reader of tasks in any of the stream formats. Only a
+// single record, or a single block of a snapshot, is held in memory
+// at a time, so input of any size can be read.
+class TaskReader {
+public:
+    TaskReader(istream &in, StreamFormat format);
+
+    /**
+     *  @brief Reads the next task.
+     *
+     *  Records that cannot be parsed are skipped and counted. The text of
+     *  the task points into the reader's buffers and stays valid until the
+     *  next call.
+     *
+     *  @param task Task to fill in.
+     *  @return `true` if a task was read, `false` at the end of the input
+     *  or once the input turns out to be damaged.
+     */
+    bool next(TodoItem &task);
+
+    // Number of records that were skipped
+    int malformed() const { return skipped; }
+
+    // Whether a snapshot was cut short or failed its checksum
+    bool damaged() const { return is_damaged; }
+
+private:
+    bool next_csv(TodoItem &task);
+    bool next_jsonl(TodoItem &task);
+    bool next_snapshot(TodoItem &task);
+
+    // Reads the next block of a snapshot into `tasks`
+    bool read_block();
+
+    // Reads bytes of a snapshot, adding them to the checksum
+    bool read_bytes(void *data, size_t size);
+
+    // Blocks of the snapshot input, read by get_snapshot_block()
+    struct BlockSource {
+        TaskReader &reader;
+
+        const char *take(size_t size);
+        bool text(size_t size, Text &value);
+    };
+
+    istream &in;
+    StreamFormat format;
+    unique_ptr<CsvReader> csv;
+    string line;            // Current line of JSON Lines input
+    string text[TASK_FIELD_COUNT + 1];  // Unescaped fields, and keys of JSON Lines
+    int skipped = 0;
+    bool is_damaged = false;
+
+    // Snapshot input
+    bool started = false;   // Whether the header was read
+    bool finished = false;  // Whether the last block was read
+    uint32_t version = 0;   // Version of the snapshot
+    bool has_total = false; // Whether the header holds the task count
+    uint64_t total = 0;
+    uint64_t seen = 0;      // Tasks in the blocks read so far
+    uint64_t hash = 0;      // Checksum of the bytes read so far
+    uint64_t trailing = 0;  // Bytes of indexes after the end of blocks
+    TextArena arena;        // Text of the current block
+    string piece;           // Text being read
+    vector<char> columns;   // Numbers and bitsets of the block
+    TaskStore tasks;        // Tasks of the current block
+    size_t position = 0;    // Next task of the block to hand out
+};
+
+// Streaming writer of tasks in any of the stream formats. Tasks of
+// a snapshot are collected into blocks, everything else is written
+// as it comes.
+class TaskWriter {
+public:
+    /**
+     *  @brief Starts writing tasks.
+     *
+     *  @param out Stream to write to.
+     *  @param format Format to write in.
+     *  @param count Number of tasks that will be written, or `UINT64_MAX`
+     *  if unknown.
+     *  @param next_id ID the next added task receives, written along
+     *  with the count.
+     */
+    TaskWriter(ostream &out, StreamFormat format, uint64_t count = UINT64_MAX,
+               uint64_t next_id = NO_TASK_ID);
+
+    // Writes a task, the text of which may be discarded afterwards
+    void write(const TodoItem &task);
+
+    // Writes whatever is still held back, such as the end of a snapshot
+    bool finish();
+
+private:
+    // Writes the tasks collected for a snapshot block
+    void write_block();
+
+    // Writes bytes of a snapshot, adding them to the checksum
+    void emit(const string &bytes);
+
+    ostream &out;
+    StreamFormat format;
+    uint64_t count;
+    uint64_t written = 0;
+    uint64_t hash = 0;      // Checksum of the snapshot written so far
+    string buffer;          // Output waiting to be written
+    vector<TodoItem> block; // Tasks of the current snapshot block
+    TextArena arena;        // Text of the current snapshot block
+};
+
+// Samples of one kind of operation, collected while profiling
+struct OperationTimes {
+    vector<uint64_t> durations;     // Nanoseconds of every run
+    uint64_t total = 0;             // Sum of durations
+};
+
+// Single event of the Chrome trace
+struct TraceEvent {
+    string_view name;       // Points to the key in Profile::operations
+    uint64_t start;         // Nanoseconds since profiling started
+    uint64_t duration;
+};
+
+// Time spent in each operation, collected while `--stats` or `--trace`
+// is given, and totals of the work done, which are always counted.
+// Operations may be recorded on any thread; the counters are only
+// updated by the main thread, apart from the bytes the persistence
+// thread writes.
+class Profile {
+public:
+    // Starts recording operations, and events for the trace if asked to
+    void enable(bool trace);
+
+    bool enabled() const { return is_enabled; }
+
+    // When profiling was enabled
+    chrono::steady_clock::time_point start() const { return started; }
+
+    // Adds a run of an operation
+    void record(string_view name, chrono::steady_clock::time_point start,
+                chrono::steady_clock::time_point stop);
+
+    // Prints a table of the operations and the counters
+    void print(ostream &out) const;
+
+    /**
+     *  @brief Writes the recorded events in Chrome's trace event format.
+     *
+     *  @param path Path of the JSON file to write.
+     *  @return `true` if the file was written, `false` if otherwise.
+     */
+    bool write_trace(const char *path) const;
+
+    // Tasks read from save files, journals and imported files
+    uint64_t rows_parsed = 0;
+
+    // Bytes read from save files and journals
+    uint64_t bytes_read = 0;
+
+    // Bytes written to save files, journals and exported files
+    atomic<uint64_t> bytes_written{0};
+
+private:
+    bool is_enabled = false;
+    bool keeps_trace = false;
+    chrono::steady_clock::time_point started;
+    mutex lock;             // Held while recording, queries of the server run on threads
+    map<string, OperationTimes, less<>> operations;
+    vector<TraceEvent> events;
+};
+
+// Records the time from its construction to its destruction as a run
+// of an operation. Costs a single check while profiling is disabled.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(string_view name);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    string_view name;
+    bool running;
+    chrono::steady_clock::time_point start;
+};
+
+// Function declarations
+// Main command functions
+
+/**
+ *  @brief Adds a new task to the to-do list.
+ *  
+ *  This function prompts the user to enter details for a new task,
+ *  including the title, description, and due date. If the user
+ *  provides valid input, the task is added to the `todo_items` vector.
+ */
+void add();
+
+/**
+ *  @brief Displays all tasks in the to-do list.
+ * 
+ *  This function iterates through the `todo_items` vector and prints
+ *  the detail of each task, including the title, description, due date,
+ *  status of completion.
+ */
+void view();
+
+/**
+ *  @brief Prints the details of a range of tasks.
+ *
+ *  Only the tasks in the range are formatted. Output is collected in a
+ *  buffer and written in large chunks rather than line by line.
+ *
+ *  @param out Stream to print to.
+ *  @param items Tasks to print from, such as `todo_items`.
+ *  @param first Zero-based index of the first task to print, not
+ *  counting removed tasks.
+ *  @param count Maximum number of tasks to print.
+ */
+void print_tasks(ostream &out, const TaskStore &items, size_t first = 0, size_t count = SIZE_MAX);
+
+/**
+ *  @brief Prints the details of selected tasks.
+ *
+ *  @param out Stream to print to.
+ *  @param items Tasks to print from.
+ *  @param slots Index of `items` by ID.
+ *  @param ids IDs of the tasks, in printing order.
+ */
+void print_task_list(ostream &out, const TaskStore &items, const TaskTable &slots,
+                     const vector<uint64_t> &ids);
+
+/**
+ *  @brief Formats the details of a task.
+ *
+ *  @param out String to append the details to.
+ *  @param items Tasks the task belongs to.
+ *  @param position Zero-based index of the task in `items`.
+ */
+void append_task(string &out, const TaskStore &items, size_t position);
+
+/**
+ *  @brief Marks a task as completed.
+ *  
+ *  This function prompts the user to select a task by its position in
+ *  the `todo_items` vector. If the task is not already marked as completed,
+ *  it sets the task's `completed` attribute to true.
+ */
+void mark();
+
+/**
+ *  @brief Edits an existing task in the to-do list.
+ * 
+ *  This function prompts the user to select a task by its position in the
+ *  `todo_items` vector and then allows the user to modify the task's title, 
+ *  description, and due date. The task is updated with the new details.
+ */
+void edit();
+
+/**
+ *  @brief Removes a task from the to-do list.
+ *  
+ *  This function prompts the user to select a task by its position in
+ *  the `todo_items` vector and confirms the deletion. If confirmed, the task
+ *  is removed from the vector.
+ */
+void remove();
+
+// Tools
+
+/**
+ *  @brief Clears the terminal screen.
+ *
+ *  The screen is cleared in-process, through ANSI escape sequences or,
+ *  on Windows, through the console API, instead of running an external
+ *  command. Nothing happens when standard output is not a terminal.
+ */
+void clear_screen();
+
+/**
+ *  @brief Gets the position of a task in the to-do list.
+ * 
+ *  This function prompts the user to enter the number of task they want to
+ *  interact with, which is the task's ID. It validates the input and returns
+ *  the zero-based index of the task in the `todo_items` vector.
+ * 
+ *  @param action A string indicating the action being performed (e.g., "edit").
+ *  @return The zero-based index of the task in the vector, or -1 if the
+ *  operation is aborted.
+ */
+int get_item_position(string_view action);
+
+/**
+ *  @brief Checks if a year is a leap year.
+ * 
+ *  This function determines if the given year is a leap year based on the
+ *  standard leap year rules.
+ * 
+ *  @param year The year to check.
+ *  @return `true` if the year is a leap year, `false` if otherwise.
+ */
+bool is_leap_year(int year);
+
+/**
+ *  @brief Validates a date string.
+ * 
+ *  This function checks if the given date string is in the format DD/MM/YYYY
+ *  and represents a valid date.
+ * 
+ *  @param date_str The date string to validate.
+ *  @return `true` if the date is valid, `false` if otherwise.
+ */
+bool is_valid_date(string_view date_str);
+
+/**
+ *  @brief Checks if a day exists in the calendar.
+ *
+ *  @param day Day of the month.
+ *  @param month Month of the year, starting at 1.
+ *  @param year The year.
+ *  @return `true` if the day exists, `false` if otherwise.
+ */
+bool is_valid_day(int day, int month, int year);
+
+/**
+ *  @brief Prompts the user for a valid date input.
+ * 
+ *  This function continuously prompts the user to enter a date until a valid
+ *  date in the format DD/MM/YYYY is provided. Each line is parsed once,
+ *  straight into a packed date.
+ * 
+ *  @return The date entered, as a number of days since 1 January 1970.
+ */
+int32_t get_date_input();
+
+/**
+ *  @brief Gets the current date.
+ *
+ *  @return Today's date in local time, as a number of days since
+ *  1 January 1970.
+ */
+int32_t today();
+
+/**
+ *  @brief Counts the days between 1 January 1970 and a date.
+ *
+ *  @param year The year.
+ *  @param month Month of the year, starting at 1.
+ *  @param day Day of the month.
+ *  @return Number of days, negative for earlier dates.
+ */
+int32_t days_from_civil(int year, int month, int day);
+
+/**
+ *  @brief Packs a date string into a number of days.
+ *
+ *  The string is parsed in place, accepting the same input as
+ *  `is_valid_date()`, so that no memory is allocated.
+ *
+ *  @param date_str Date in the format DD/MM/YYYY.
+ *  @return Number of days since 1 January 1970, or `NO_DUE_DATE` if the
+ *  date is not valid.
+ */
+int32_t pack_date(string_view date_str);
+
+/**
+ *  @brief Formats a packed date as a string.
+ *
+ *  @param days Number of days since 1 January 1970.
+ *  @return Date string in the format DD/MM/YYYY, or an empty string
+ *  for `NO_DUE_DATE`.
+ */
+string format_date(int32_t days);
+
+/**
+ *  @brief Appends a packed date to a string.
+ *
+ *  @param out String to append the date to.
+ *  @param days Number of days since 1 January 1970.
+ */
+void append_date(string &out, int32_t days);
+
+// File IO functions
+
+/**
+ *  @brief Scans a single CSV record from a buffer.
+ *
+ *  This function runs a small state machine over the bytes in range
+ *  [`begin`, `end`) and splits the first record into its fields. Fields
+ *  may be quoted, in which case they can contain commas, newlines and
+ *  doubled quotes (""). Records end at a newline outside of quotes.
+ *
+ *  @param begin Start of the input.
+ *  @param end End of the input.
+ *  @param at_eof Whether `end` is the end of all input. If not, a record
+ *  running into `end` is reported as incomplete.
+ *  @param record Record to fill with the fields that were scanned.
+ *  @param next Set to the start of the following record.
+ *  @return `CSV_RECORD`, `CSV_BLANK`, `CSV_MALFORMED` or `CSV_INCOMPLETE`.
+ */
+CsvStatus scan_csv_record(const char *begin, const char *end, bool at_eof,
+                          CsvRecord &record, const char *&next);
+
+/**
+ *  @brief Copies a CSV field into a string.
+ *
+ *  Doubled quotes inside the field are collapsed into a single quote.
+ *
+ *  @param out String to hold the field value.
+ *  @param field Field to copy.
+ */
+void assign_csv_field(string &out, const CsvField &field);
+
+/**
+ *  @brief Converts a CSV record into a task.
+ *
+ *  @param record Record holding the task fields.
+ *  @param item Task to fill.
+ *  @param borrow Whether text fields may refer to the record's buffer
+ *  instead of copying it. Fields containing doubled quotes are always
+ *  copied since they have to be unescaped.
+ *  @param unescaped A string per field of `task_schema` to unescape text
+ *  fields into, which the task then refers to instead of the text arena.
+ *  Only used if `borrow` is set.
+ *  @return `true` if the record holds a valid task, `false` if otherwise.
+ */
+bool record_to_item(const CsvRecord &record, TodoItem &item, bool borrow,
+                    string *unescaped = nullptr);
+
+/**
+ *  @brief Parses CSV text into tasks, using several threads for large
+ *  input.
+ *
+ *  The text is split into ranges of about equal size, one per thread.
+ *  Each range starts after a newline that is outside quotes, as told by
+ *  the number of quote characters before it, so that quoted fields may
+ *  contain newlines. Should the ranges turn out not to line up with the
+ *  records, which happens with stray quotes in unquoted fields, the text
+ *  is parsed again on a single thread.
+ *
+ *  @param begin Start of the text.
+ *  @param end End of the text.
+ *  @param borrow Whether text fields may refer to the input.
+ *  @param items Store to add the tasks to, in order of the input.
+ *  @param offsets If given, receives the offset of the record of every
+ *  task added, counted from `begin`.
+ *  @return Number of lines that could not be parsed.
+ */
+int parse_csv(const char *begin, const char *end, bool borrow, TaskStore &items,
+              vector<uint64_t> *offsets = nullptr);
+
+/**
+ *  @brief Parses the CSV records that start within a range.
+ *
+ *  @param begin Start of the first record.
+ *  @param stop Records starting at or after this point are left alone.
+ *  @param end End of the text, where the last record has to end.
+ *  @param borrow Whether text fields may refer to the input.
+ *  @param items Store to add the tasks to.
+ *  @param malformed Incremented for every line that could not be parsed.
+ *  @param offsets If given, receives the offset of the record of every
+ *  task added, counted from `origin`.
+ *  @param origin Start of the whole text.
+ *  @return End of the last record parsed.
+ */
+const char *parse_csv_range(const char *begin, const char *stop, const char *end,
+                            bool borrow, TaskStore &items, int &malformed,
+                            vector<uint64_t> *offsets = nullptr, const char *origin = nullptr);
+
+/**
+ *  @brief Writes a string as a quoted CSV field.
+ *
+ *  Quotes inside the string are doubled so that the field can be read
+ *  back by `scan_csv_record()`.
+ *
+ *  @param out Stream to write to.
+ *  @param value String to write.
+ */
+void write_csv_field(ostream &out, string_view value);
+
+/**
+ *  @brief Writes a task as a CSV record.
+ *
+ *  @param out Stream to write to.
+ *  @param task Task to write, in the layout of the save file.
+ */
+void write_csv_task(ostream &out, const TodoItem &task);
+
+/**
+ *  @brief Writes a string as a JSON string, with quotes around it.
+ *
+ *  @param out String to append to.
+ *  @param value String to write, UTF-8 encoded.
+ */
+void write_json_string(string &out, string_view value);
+
+/**
+ *  @brief Reads a JSON string.
+ *
+ *  @param p Opening quote of the string, moved past the closing quote.
+ *  @param end End of the input.
+ *  @param scratch String to unescape into, if the string has escapes.
+ *  @param value Set to the characters of the string, pointing into the
+ *  input or into `scratch`.
+ *  @return `true` if the string is valid, `false` if otherwise.
+ */
+bool scan_json_string(const char *&p, const char *end, string &scratch, string_view &value);
+
+/**
+ *  @brief Parses a JSON object into a task.
+ *
+ *  The object holds the task fields `id`, `title`, `description`, `due`
+ *  and `completed`; all but `title` may be left out. Other fields are
+ *  ignored, unless they hold objects or arrays. Due dates are strings of
+ *  the form DD/MM/YYYY, or null.
+ *
+ *  @param p Start of the object.
+ *  @param end End of the input, which may only hold the object.
+ *  @param task Task to fill in. Its text points into the input or into
+ *  `unescaped`.
+ *  @param unescaped A string per field of `task_schema` and one more for
+ *  keys, to unescape text into.
+ *  @return `true` if the object holds a valid task, `false` if otherwise.
+ */
+bool parse_json_task(const char *p, const char *end, TodoItem &task, string *unescaped);
+
+/**
+ *  @brief Skips a JSON literal such as `null`.
+ *
+ *  @param p Start of the value, moved past the literal if it is there.
+ *  @param end End of the input.
+ *  @param literal Literal to skip.
+ *  @return `true` if the literal was skipped, `false` if otherwise.
+ */
+bool skip_json_literal(const char *&p, const char *end, const char *literal);
+
+/**
+ *  @brief Converts tasks into CSV text.
+ *
+ *  Each task is written in a single line with fields enclosed in quotes,
+ *  its ID last.
+ *
+ *  @param items Tasks to convert, none of them removed.
+ *  @param offsets If given, receives the offset of the record of every task.
+ *  @return Contents of the CSV file.
+ */
+string serialise_csv(const TaskStore &items, vector<uint64_t> *offsets = nullptr);
+
+/**
+ *  @brief Converts tasks into a binary snapshot.
+ *
+ *  A snapshot starts with a header holding `SNAPSHOT_MAGIC`, the format
+ *  version, flags and the number of tasks. Tasks follow in blocks of up
+ *  to `SNAPSHOT_BLOCK_SIZE`, each holding the block's task count, a string
+ *  table with the length-prefixed title and description of every task,
+ *  the packed due dates and a bitset of completion states. A block with
+ *  a count of zero ends the list, followed by an FNV-1a checksum of all
+ *  preceding bytes. Numbers are stored in little-endian byte order.
+ *
+ *  Since version 2, the header ends with the next task ID and every
+ *  block holds the IDs of its tasks right after the task count.
+ *  Snapshots written by `TaskWriter` without knowing the number of tasks
+ *  have `SNAPSHOT_FLAG_STREAMED` set, and zero for both count and next ID.
+ *
+ *  Since version 3, the header goes on with the number of blocks, the
+ *  number of prebuilt indexes and the offset of the end of blocks. With
+ *  `SNAPSHOT_FLAG_INDEXED` set, a table of the offset and checksum of
+ *  every block follows, then a table of the kind, offset, size and
+ *  checksum of every index, then a checksum of the header and tables.
+ *  Indexes come after the end of blocks. Snapshots of `TaskWriter` have
+ *  empty tables, and only the checksum.
+ *
+ *  @param items Tasks to convert, none of them removed.
+ *  @param next_id ID the next added task receives.
+ *  @param due Index of the due dates to save along, if built.
+ *  @return Contents of the snapshot file.
+ */
+string serialise_snapshot(const TaskStore &items, uint64_t next_id, const DueIndex *due = nullptr);
+
+/**
+ *  @brief Appends a block of tasks to a snapshot.
+ *
+ *  The layout follows from `task_schema`: the task count, then the
+ *  sections of `SnapshotSection` in order, fields of the same section
+ *  in the order of the schema.
+ *
+ *  @param out Snapshot to append to.
+ *  @param tasks `TaskStore` or vector of tasks to take the tasks from.
+ *  @param first Index of the first task of the block.
+ *  @param count Number of tasks, at most `SNAPSHOT_BLOCK_SIZE`.
+ */
+template <typename Tasks>
+void put_snapshot_block(string &out, const Tasks &tasks, size_t first, size_t count);
+
+/**
+ *  @brief Reads the tasks of a snapshot block, after its task count.
+ *
+ *  Fields the snapshot's version does not have keep their defaults.
+ *
+ *  @param in `SnapshotBytes` or other source of the bytes of the block.
+ *  @param version Version of the snapshot.
+ *  @param first Index of the first task of the block in `items`.
+ *  @param count Number of tasks in the block.
+ *  @param items Store to read the tasks into, holding room for them.
+ *  @return `true` if the block was read, `false` if the input ends early.
+ */
+template <typename Source>
+bool get_snapshot_block(Source &in, uint32_t version, size_t first, size_t count, TaskStore &items);
+
+/**
+ *  @brief Reads tasks from a binary snapshot.
+ *
+ *  The checksum is verified before anything is read. Text fields
+ *  refer to `data` directly.
+ *
+ *  @param data Contents of the snapshot file.
+ *  @param size Size of the snapshot file.
+ *  @param items List to add the tasks to. Tasks of version 1
+ *  snapshots have no ID.
+ *  @param next_id Set to the next task ID, if the snapshot has one.
+ *  @param due Index to take over the saved due index into, if any.
+ *  @return `true` if the snapshot is intact, `false` if otherwise.
+ */
+bool parse_snapshot(const char *data, size_t size, TaskStore &items, uint64_t &next_id,
+                    DueIndex *due = nullptr);
+
+/**
+ *  @brief Reads tasks from a snapshot with `SNAPSHOT_FLAG_INDEXED` set.
+ *
+ *  Instead of the checksum of the whole file, the checksums of the
+ *  header and of every block are verified, while blocks are read on
+ *  several threads. Saved indexes that fail their checksum are left
+ *  out, to be built when needed.
+ *
+ *  @param data Contents of the snapshot file.
+ *  @param size Size of the snapshot file.
+ *  @param items List to add the tasks to.
+ *  @param next_id Set to the next task ID.
+ *  @param due Index to take over the saved due index into, if any.
+ *  @return `true` if the snapshot is intact, `false` if otherwise.
+ */
+bool parse_indexed_snapshot(const char *data, size_t size, TaskStore &items, uint64_t &next_id,
+                            DueIndex *due);
+
+/**
+ *  @brief Checks whether a file starts like a binary snapshot.
+ *
+ *  @param data Contents of the file.
+ *  @param size Size of the file.
+ *  @return `true` if the file is a binary snapshot, `false` if otherwise.
+ */
+bool is_snapshot(const char *data, size_t size);
+
+/**
+ *  @brief Writes a whole file at once.
+ *
+ *  @param path Path of the file to write. Existing files are overwritten.
+ *  @param contents Contents of the file.
+ *  @return `true` if the file was written, `false` if otherwise.
+ */
+bool write_file(const char *path, const string &contents);
+
+/**
+ *  @brief Replaces a file without ever leaving it half-written.
+ *
+ *  The contents are written to a temporary file in the same directory,
+ *  forced to disk and then renamed over `path` in a single step. If
+ *  anything fails, the original file is left untouched.
+ *
+ *  @param path Path of the file to replace.
+ *  @param contents New contents of the file.
+ *  @return `true` if the file was replaced, `false` if otherwise.
+ */
+bool replace_file(const char *path, const string &contents);
+
+/**
+ *  @brief Writes a buffer to a file descriptor.
+ *
+ *  @param fd File descriptor to write to.
+ *  @param data Bytes to write.
+ *  @param size Number of bytes to write.
+ *  @return `true` if all bytes were written, `false` if otherwise.
+ */
+bool write_all(int fd, const char *data, size_t size);
+
+/**
+ *  @brief Saves the current tasks to save file.
+ * 
+ *  This function writes all tasks in the `todo_items` vector to the file
+ *  of the active list, `data_path`, in the format selected by
+ *  `save_format`. Nothing is written unless `todo_items_dirty` is set.
+ *  The file is replaced atomically through `replace_file()`, so the
+ *  previous version survives a crash or a full disk. Text borrowed from
+ *  the mapping of the previous version stays valid, except on Windows,
+ *  where the mapping has to be released before the file can be replaced.
+ *  Marks and edits of a CSV file are patched into it instead, as long as
+ *  `patch_save_file()` can.
+ */
+void save_data();
+
+/**
+ *  @brief Writes marked and edited tasks into the CSV save file in place.
+ *
+ *  Possible only while no task was added or removed, and only if every
+ *  field of every changed record keeps its size, so that an interrupted
+ *  write leaves records that still parse. The journal is flagged first,
+ *  so that it is replayed over a partly patched file after a crash.
+ *  Edits are not patched while snapshots share the mapping, since they
+ *  may still read the old text from it.
+ *
+ *  @return `true` if the file was patched, `false` if it has to be
+ *  rewritten.
+ */
+bool patch_save_file();
+
+/**
+ *  @brief Retrieves tasks from a file.
+ * 
+ *  This function reads tasks from the program save file specified by 
+ *  `data_path` and loads them into the `todo_items` vector. The
+ *  file may either be a CSV file, in which case each line in the file is
+ *  parsed to extract task details, or a binary snapshot. The file is mapped
+ *  into `save_file` and task text refers to the mapping directly.
+ *  `save_format` is set to the format the file was found in. If a snapshot
+ *  fails validation, `save_file_damaged` is set and no tasks are returned;
+ *  the caller has to stop so that the file is not overwritten. Problems
+ *  are reported to `load_errors`.
+ *  
+ *  @return A vector of `TodoItem` containing all tasks read from the file.
+ */
+TaskStore retrieve_data();
+
+/**
+ *  @brief Tells the stream format of a file from its extension.
+ *
+ *  @param path Path of the file.
+ *  @return `STREAM_JSONL` for `.jsonl` files, `STREAM_SNAPSHOT` for
+ *  `.snap` files, `STREAM_CSV` for everything else.
+ */
+StreamFormat stream_format_of(const string &path);
+
+/**
+ *  @brief Parses the name of a stream format.
+ *
+ *  @param name `csv`, `jsonl` or `binary`.
+ *  @param format Set to the format.
+ *  @return `true` if the name is known, `false` if otherwise.
+ */
+bool parse_stream_format(const string &name, StreamFormat &format);
+
+/**
+ *  @brief Adds the tasks of a file to the to-do list.
+ *
+ *  The format of the file is told by `stream_format_of()`. CSV files are
+ *  mapped and parsed on several threads, other files are read one task at
+ *  a time.
+ *
+ *  @param path Path of the file to import.
+ *  @return Number of tasks imported, or -1 if the file cannot be opened
+ *  or is damaged.
+ */
+int import_tasks(const char *path);
+
+/**
+ *  @brief Writes the to-do list to a file, one task at a time.
+ *
+ *  @param path Path of the file to create, in the format told by
+ *  `stream_format_of()`.
+ *  @return `true` if the file was written, `false` if otherwise.
+ */
+bool export_tasks(const char *path);
+
+/**
+ *  @brief Converts tasks from one format into another.
+ *
+ *  Tasks are passed on as they are read, so memory use does not
+ *  depend on the size of the input. The to-do list is not touched.
+ *
+ *  @param input Path of the file to read, or `-` for standard input.
+ *  @param from Format of the input.
+ *  @param output Path of the file to write, or `-` for standard output.
+ *  @param to Format of the output.
+ *  @return Number of tasks converted, or -1 on failure.
+ */
+long long convert_tasks(const string &input, StreamFormat from,
+                        const string &output, StreamFormat to);
+
+/**
+ *  @brief Prints the command line options of the program.
+ *
+ *  @param program Name the program was started with.
+ */
+void print_usage(const char *program);
+
+/**
+ *  @brief Prints the profile for `--stats` and writes the trace for
+ *  `--trace`, registered to run on exit.
+ */
+void report_profile();
+
+// Command mode functions
+
+/**
+ *  @brief Runs a single non-interactive command.
+ *
+ *  Supported commands are `add`, `mark`, `edit`, `remove`, `view` and
+ *  `use`, among others, see `print_usage()`. Commands neither clear the
+ *  screen nor wait for the user, and changes are only recorded in the
+ *  journal; the caller is responsible for committing them through
+ *  `flush_changes()`.
+ *
+ *  @param args Command name followed by its arguments.
+ *  @param out Stream to write the command output to.
+ *  @param err Stream to write error messages to.
+ *  @return `true` if the command succeeded, `false` if otherwise.
+ */
+bool run_command(const vector<string> &args, ostream &out, ostream &err);
+
+/**
+ *  @brief Runs `mark` or `remove` on many tasks at once.
+ *
+ *  Tasks are selected by a set of IDs such as `10-500` or `1,4,9-12`, by
+ *  `--completed` and by `--due-before DATE`, and have to match all of
+ *  them. The selected tasks are changed through `commit_bulk()`.
+ *
+ *  @param args Command name followed by its arguments.
+ *  @param out Stream to write the number of changed tasks to.
+ *  @param err Stream to write error messages to.
+ *  @return `true` if the command succeeded, `false` if otherwise.
+ */
+bool run_bulk(const vector<string> &args, ostream &out, ostream &err);
+
+/**
+ *  @brief Parses a set of task IDs, such as `1,4,9-12`.
+ *
+ *  @param arg IDs and inclusive ranges of IDs, separated by commas.
+ *  @param ranges Set to the ranges of IDs, sorted and merged.
+ *  @return `true` if the set is valid, `false` if otherwise.
+ */
+bool parse_id_set(const string &arg, vector<pair<uint64_t, uint64_t>> &ranges);
+
+/**
+ *  @brief Tells commands that only read tasks from the others.
+ *
+ *  @param name Name of the command.
+ *  @return `true` for `view`, `search`, `stats`, `overdue`, `week`,
+ *  `next` and `history`, `false` if otherwise.
+ */
+bool is_query(const string &name);
+
+/**
+ *  @brief Runs a command that only reads tasks.
+ *
+ *  @param view Tasks to read, of the active list or of a snapshot.
+ *  @param args Command name followed by its arguments.
+ *  @param out Stream to write the command output to.
+ *  @param err Stream to write error messages to.
+ *  @return `true` if the command succeeded, `false` if otherwise.
+ */
+bool run_query(const ListView &view, const vector<string> &args, ostream &out, ostream &err);
+
+// Tasks and indexes of the active list, for queries to read
+ListView active_view();
+
+/**
+ *  @brief Copies the active list for queries on other threads.
+ *
+ *  The columns and the ID table are copied, and the due date index if
+ *  it is built. Text is shared with the list rather than copied.
+ *
+ *  @return Snapshot of the active list at its current version.
+ */
+shared_ptr<ListSnapshot> take_snapshot();
+
+/**
+ *  @brief Brings an earlier snapshot of the active list up to date.
+ *
+ *  Only the tasks changed since the snapshot's version are copied, from
+ *  the change log. No query may be reading the snapshot.
+ *
+ *  @param snapshot Snapshot to update.
+ *  @return `true` if the snapshot is at the current version, `false` if
+ *  it has to be taken again, such as when the log does not go back far
+ *  enough or copying the list is about as quick.
+ */
+bool refresh_snapshot(ListSnapshot &snapshot);
+
+// Adds a task changed in the current version to the change log
+void log_change(uint64_t id);
+
+// Drops the changes that all snapshots of the active list already hold
+void trim_change_log(uint64_t version);
+
+/**
+ *  @brief Runs commands read from a stream, one per line.
+ *
+ *  Empty lines and lines starting with `#` are skipped. Arguments are
+ *  separated by spaces and may be enclosed in double quotes. Failing
+ *  commands are reported along with their line number, and the remaining
+ *  commands still run.
+ *
+ *  @param in Stream to read commands from.
+ *  @return Number of commands that failed.
+ */
+int run_batch(istream &in);
+
+/**
+ *  @brief Splits a command line into arguments.
+ *
+ *  Arguments are separated by whitespace. Double quotes group words into
+ *  a single argument, and a backslash escapes the character after it.
+ *
+ *  @param line Command line to split.
+ *  @param args List to fill with the arguments.
+ *  @return `true` if the line was split, `false` if a quote is not closed.
+ */
+bool split_command_line(const string &line, vector<string> &args);
+
+/**
+ *  @brief Parses a number given on the command line.
+ *
+ *  @param arg Decimal number.
+ *  @param number Set to the value of the number.
+ *  @return `true` if the number is valid, `false` if otherwise.
+ */
+bool parse_number(const string &arg, size_t &number);
+
+/**
+ *  @brief Parses a task number given on the command line.
+ *
+ *  @param arg Task number, which is the task's ID.
+ *  @param position Set to the zero-based index of the task.
+ *  @return `true` if the task exists, `false` if otherwise.
+ */
+bool parse_task_number(const string &arg, uint32_t &position);
+
+// Sorting functions
+
+/**
+ *  @brief Parses a comma-separated list of sort keys.
+ *
+ *  @param arg Keys, such as "completed,due".
+ *  @param keys Set to the keys in order.
+ *  @return `true` if all keys are known, `false` if otherwise.
+ */
+bool parse_sort_keys(const string &arg, vector<SortKey> &keys);
+
+/**
+ *  @brief Sorts the tasks by a list of keys.
+ *
+ *  Indexes are sorted rather than the tasks themselves. When the keys
+ *  other than completion are just the due date and the due date index
+ *  exists, the incomplete tasks it holds are taken from it in order
+ *  and only the remaining tasks are sorted. The result is kept until
+ *  the next change to the list.
+ *
+ *  @param view Tasks to sort. Sorting a snapshot requires holding its
+ *  `sort_lock` for as long as the result is used.
+ *  @param keys Keys to sort by.
+ *  @return Zero-based indexes of all tasks that were not removed.
+ */
+const vector<uint32_t> &sort_tasks(const ListView &view, const vector<SortKey> &keys);
+
+/**
+ *  @brief Sorts values on several threads.
+ *
+ *  Slices of the values are sorted on threads of their own and then
+ *  merged pairwise, again in parallel.
+ *
+ *  @param values Values to sort.
+ *  @param less Strict weak ordering of the values.
+ */
+template <class Compare>
+void parallel_sort(vector<uint32_t> &values, Compare less);
+
+// Filter kernels
+
+// Kernel testing 64 due dates against a range of days
+typedef uint64_t (*DueRangeKernel)(const int32_t *dates, int32_t from, int32_t to);
+
+/**
+ *  @brief Tests 64 due dates against a range of days, one at a time.
+ *
+ *  @param dates First of the 64 dates.
+ *  @param from First day of the range, after `NO_DUE_DATE`.
+ *  @param to Day after the last day of the range.
+ *  @return Mask with bit i set if `dates[i]` lies within the range.
+ */
+uint64_t due_range_mask_scalar(const int32_t *dates, int32_t from, int32_t to);
+
+#if defined(__x86_64__) || defined(__i386__)
+// Same as due_range_mask_scalar(), eight dates at a time with AVX2
+uint64_t due_range_mask_avx2(const int32_t *dates, int32_t from, int32_t to);
+#elif defined(__aarch64__)
+// Same as due_range_mask_scalar(), four dates at a time with NEON
+uint64_t due_range_mask_neon(const int32_t *dates, int32_t from, int32_t to);
+#endif
+
+/**
+ *  @brief Picks the fastest kernel the processor supports.
+ *
+ *  @return Kernel to test due dates with.
+ */
+DueRangeKernel select_due_range_kernel();
+
+/**
+ *  @brief Selects the incomplete tasks of a block that are due within
+ *  a range of days.
+ *
+ *  @param items Tasks to look at.
+ *  @param block Index of the block of 64 tasks.
+ *  @param from First day of the range. Tasks without a due date never
+ *  match.
+ *  @param to Day after the last day of the range.
+ *  @return Mask with bit i set if task `64 * block + i` matches.
+ */
+uint64_t select_due(const TaskStore &items, size_t block, int32_t from, int32_t to);
+
+/**
+ *  @brief Counts the incomplete tasks due within a range of days.
+ *
+ *  @param items Tasks to look at.
+ *  @param from First day of the range.
+ *  @param to Day after the last day of the range.
+ *  @return Number of matching tasks.
+ */
+size_t count_due(const TaskStore &items, int32_t from, int32_t to);
+
+/**
+ *  @brief Finds the incomplete tasks due within a range of days.
+ *
+ *  @param items Tasks to look at.
+ *  @param from First day of the range.
+ *  @param to Day after the last day of the range.
+ *  @return IDs of the matching tasks, ordered by due date.
+ */
+vector<uint64_t> find_due(const TaskStore &items, int32_t from, int32_t to);
+
+/**
+ *  @brief Counts the completed tasks.
+ *
+ *  @param items Tasks to look at.
+ *  @return Number of completed tasks.
+ */
+size_t count_completed(const TaskStore &items);
+
+// Task ID functions
+
+/**
+ *  @brief Gives IDs to the loaded tasks and fills `task_slots`.
+ *
+ *  Tasks loaded without an ID, or with the ID of an earlier task, are
+ *  given new IDs in order. `next_task_id` is moved past every ID in use.
+ */
+void index_tasks();
+
+/**
+ *  @brief Looks up a task by ID.
+ *
+ *  @param id ID of the task.
+ *  @return Zero-based index of the task in `todo_items`, or
+ *  `TaskTable::npos` if there is no such task.
+ */
+uint32_t find_task(uint64_t id);
+
+/**
+ *  @brief Gives back memory of text that is no longer used.
+ *
+ *  Once most of `text_arena` holds text that was replaced or removed,
+ *  the text still in use is copied into a new arena.
+ */
+void reclaim_text();
+
+/**
+ *  @brief Drops removed tasks from `todo_items`.
+ *
+ *  Remaining tasks keep their order and IDs, only their index changes.
+ */
+void compact_tasks();
+
+/**
+ *  @brief Writes all changes recorded so far to the journal.
+ *
+ *  The save file is compacted if the journal has grown too large.
+ */
+void flush_changes();
+
+/**
+ *  @brief Releases the memory mapping of the save file.
+ *
+ *  Any text in `todo_items` that still borrows from the mapping is
+ *  copied first, so that the tasks stay valid.
+ */
+void close_save_file();
+
+// Journal functions
+
+/**
+ *  @brief Applies a change to the to-do list.
+ *
+ *  Changes are idempotent: adding a task whose ID exists already, or
+ *  removing one that no longer exists, changes nothing.
+ *
+ *  @param change Change to apply.
+ *  @return `true` if the change was applied, `false` if it marks or
+ *  edits a task that does not exist.
+ */
+bool apply_change(const Change &change);
+
+/**
+ *  @brief Remembers that the record of a task has to be written again.
+ *
+ *  @param position Index of the task in `todo_items`.
+ *  @param edited Whether the text of the task changed.
+ */
+void mark_dirty(uint32_t position, bool edited);
+
+/**
+ *  @brief Records a change in the journal and applies it.
+ *
+ *  Added tasks are given the next task ID. The change is written to disk
+ *  right away, together with any other pending changes, or handed to the
+ *  persistence thread while it runs. The save file is compacted once the
+ *  journal grows too large.
+ *
+ *  @param change Change to make.
+ */
+void commit_change(Change change);
+
+/**
+ *  @brief Records the same change to many tasks and applies it.
+ *
+ *  Has the effect of `commit_change()` for every task, in a single pass:
+ *  the records go into the journal as one group, each index is updated
+ *  once, and removed tasks are dropped in one stable compaction.
+ *
+ *  @param type `CHANGE_MARK` or `CHANGE_REMOVE`.
+ *  @param positions Indexes of the tasks in `todo_items`.
+ *  @return Number of tasks changed. Tasks that are completed already
+ *  are not marked again.
+ */
+size_t commit_bulk(ChangeType type, const vector<uint32_t> &positions);
+
+/**
+ *  @brief Encodes a change as a journal record.
+ *
+ *  @param out String to append the record to.
+ *  @param change Change to encode.
+ */
+void encode_change(string &out, const Change &change);
+
+/**
+ *  @brief Decodes the payload of a journal record.
+ *
+ *  @param data Start of the payload.
+ *  @param size Size of the payload.
+ *  @param version Version of the journal the record belongs to.
+ *  Version 1 records refer to tasks by position rather than by ID.
+ *  @param change Change to fill.
+ *  @return `true` if the payload is well-formed, `false` if otherwise.
+ */
+bool decode_change(const char *data, size_t size, uint32_t version, Change &change);
+
+/**
+ *  @brief Replays the journal on top of the loaded save file.
+ *
+ *  Records are applied in order until the end of the file or the first
+ *  damaged record, which is where an interrupted write ended. Journals
+ *  that belong to a different version of the save file are ignored.
+ *  The journal is then opened for appending further changes.
+ *
+ *  @return Number of changes replayed.
+ */
+size_t open_journal();
+
+/**
+ *  @brief Folds the journal into the save file.
+ *
+ *  The save file is rewritten with the current tasks and the journal
+ *  is emptied.
+ */
+void compact();
+
+/**
+ *  @brief Checks whether the journal is due for compaction.
+ *
+ *  @return `true` once the journal reaches half the size of the save
+ *  file, with a minimum of `JOURNAL_COMPACT_SIZE`, `false` if otherwise.
+ */
+bool needs_compaction();
+
+// Archive functions
+
+/**
+ *  @brief Compresses bytes with a fast LZ77 scheme.
+ *
+ *  The output is a series of sequences, each a token byte holding the
+ *  number of literals and the match length minus `LZ_MIN_MATCH` in its
+ *  upper and lower four bits, further length bytes for either of them
+ *  that reaches 15, the literals, and the distance back to the match in
+ *  two little-endian bytes. The last sequence has literals only. Matches
+ *  are found through a hash table of 4-byte sequences.
+ *
+ *  @param data Bytes to compress.
+ *  @param size Number of bytes.
+ *  @param out String to append the compressed bytes to.
+ */
+void lz_compress(const char *data, size_t size, string &out);
+
+/**
+ *  @brief Reverses `lz_compress()`.
+ *
+ *  @param data Compressed bytes.
+ *  @param size Number of compressed bytes.
+ *  @param raw_size Number of bytes they decompress to.
+ *  @param out String to append the decompressed bytes to.
+ *  @return `true` if the input is well-formed and of the expected size,
+ *  `false` if otherwise.
+ */
+bool lz_decompress(const char *data, size_t size, size_t raw_size, string &out);
+
+/**
+ *  @brief Moves completed tasks into the archive of the active list.
+ *
+ *  The archive is written first and the tasks are removed afterwards,
+ *  so that no task is lost if the program stops in between.
+ *
+ *  @param before Tasks due on this day or later stay in the list.
+ *  @return Number of tasks archived, or -1 if the archive cannot be
+ *  read or written.
+ */
+int archive_tasks(int32_t before);
+
+/**
+ *  @brief Prints archived tasks of a list.
+ *
+ *  Archived tasks that are in the list as well, which happens if the
+ *  program stopped while archiving them, are left out.
+ *
+ *  @param out Stream to print to.
+ *  @param err Stream to write error messages to.
+ *  @param view List the archive belongs to.
+ *  @param query Words the tasks have to contain, or nullptr for all.
+ *  @param first Number of tasks to skip.
+ *  @param count Maximum number of tasks to print.
+ *  @return `true` if the archive could be read, `false` if otherwise.
+ */
+bool print_archived(ostream &out, ostream &err, const ListView &view,
+                    const string *query, size_t first, size_t count);
+
+// Multi-list functions
+
+/**
+ *  @brief Checks whether a list name can be used as a file name.
+ *
+ *  @param name Name to check.
+ *  @return `true` if the name is made of letters, digits, `-` and `_`
+ *  only, `false` if otherwise.
+ */
+bool is_list_name(const string &name);
+
+/**
+ *  @brief Finds the save file of a list.
+ *
+ *  @param name Name of the list.
+ *  @return `DATA_PATH` for the default list, a CSV file named after
+ *  the list in `LIST_DIRECTORY` for all others.
+ */
+string list_data_path(const string &name);
+
+/**
+ *  @brief Creates the directory a list is saved in, if needed.
+ *
+ *  @param name Name of the list.
+ *  @return `true` if the directory exists, `false` if otherwise.
+ */
+bool create_list_directory(const string &name);
+
+/**
+ *  @brief Makes a list the active one.
+ *
+ *  Pending changes of the active list are committed and the list is put
+ *  aside, still loaded. A list that is not loaded yet is read from its
+ *  save file and journal on first use, so lists that are never used cost
+ *  nothing. Lists put aside are unloaded once they take up more than the
+ *  memory budget, least recently used first.
+ *
+ *  @param name Name of the list.
+ *  @return `true` if the list is active, `false` if its directory
+ *  cannot be created or its save file is damaged, leaving the active
+ *  list as it was.
+ */
+bool use_list(const string &name);
+
+/**
+ *  @brief Exchanges the active list with one that was put aside.
+ *
+ *  @param list List to make active, receives the previously active one.
+ */
+void swap_active_list(TodoList &list);
+
+/**
+ *  @brief Estimates the memory taken up by a loaded list.
+ *
+ *  @param items Tasks of the list.
+ *  @param arena Arena holding the text owned by the tasks.
+ *  @param file_size Size of the save file the tasks borrow text from.
+ *  @return Approximate number of bytes.
+ */
+size_t list_memory(const TaskStore &items, const TextArena &arena, size_t file_size);
+
+// Unloads the least recently used lists until the budget is kept
+void trim_lists();
+
+// Unloads all lists that are not active
+void close_lists();
+
+/**
+ *  @brief Collects the names of all lists.
+ *
+ *  @return Names of the default list, of every list in `LIST_DIRECTORY`
+ *  and of lists that were used but not saved yet, in ascending order.
+ */
+vector<string> list_names();
+
+// Server functions
+
+/**
+ *  @brief Serves commands from clients connecting to a Unix domain socket.
+ *
+ *  Lists stay loaded between requests, and each client works on a list
+ *  of its own choosing through `use`. Requests of all clients are read
+ *  in a single event loop and run one after another, so that commands
+ *  never see a list in the middle of a change. Changes made during one
+ *  pass of the loop are committed together before any of them is
+ *  answered. Runs until interrupted by SIGINT or SIGTERM.
+ *
+ *  @param path Path of the socket, which is replaced if left behind by
+ *  a server that is no longer running.
+ *  @return `true` if the server stopped after a signal, `false` if it
+ *  could not be started.
+ */
+bool serve(const char *path);
+
+/**
+ *  @brief Runs a command on the server instead of loading a list.
+ *
+ *  For `batch`, every command of the file or standard input is sent on
+ *  its own and failures are reported with their line number, as if the
+ *  commands were run locally.
+ *
+ *  @param path Path of the server's socket.
+ *  @param list List to run the commands on, or `nullptr` for the one
+ *  the server was started with.
+ *  @param args Command name followed by its arguments.
+ *  @return Exit status of the program.
+ */
+int run_remote(const char *path, const char *list, const vector<string> &args);
+
+/**
+ *  @brief Appends a request to run a command to a buffer.
+ *
+ *  Requests are a 32-bit size followed by the number of arguments and every
+ *  argument with its 32-bit length, so that arguments may contain any byte.
+ *
+ *  @param out Buffer to append to.
+ *  @param args Command name followed by its arguments.
+ */
+void encode_request(string &out, const vector<string> &args);
+
+/**
+ *  @brief Reads a request from the start of a buffer.
+ *
+ *  @param data Bytes received from the client.
+ *  @param size Number of bytes received.
+ *  @param args List to fill with the command and its arguments.
+ *  @return Number of bytes taken up by the request, 0 if it is not complete
+ *  yet, or `SIZE_MAX` if it is malformed or larger than `SOCKET_REQUEST_LIMIT`.
+ */
+size_t decode_request(const char *data, size_t size, vector<string> &args);
+
+/**
+ *  @brief Appends the answer to a request to a buffer.
+ *
+ *  Answers are a status byte, zero for success, the 32-bit lengths of the
+ *  output and of the error messages, and both of them.
+ *
+ *  @param out Buffer to append to.
+ *  @param succeeded Whether the command succeeded.
+ *  @param output Output of the command.
+ *  @param errors Error messages of the command.
+ */
+void append_response(string &out, bool succeeded, const string &output, const string &errors);
+
+// Global storage object
+TaskStore todo_items;
+
+// Characters of all text owned by todo_items
+TextArena text_arena;
+
+// Arena that text created on the current thread is copied into.
+// Worker threads use their own and hand it over when done.
+thread_local TextArena *thread_arena = &text_arena;
+
+// Whether todo_items differs from what is in the save file
+bool todo_items_dirty = false;
+
+// Index of every task in todo_items by ID
+TaskTable task_slots;
+
+// ID the next added task receives
+uint64_t next_task_id = 1;
+
+// Incomplete tasks of todo_items ordered by due date
+DueIndex due_index;
+
+// Words of todo_items and the tasks they appear in
+SearchIndex search_index;
+
+// Changed whenever tasks are added, changed, removed or moved
+uint64_t todo_items_version = 0;
+
+// Version and ID of every change of todo_items while serving, so that
+// snapshots can catch up by copying only the tasks that changed. Changes
+// before `change_log_start` are not in the log.
+vector<pair<uint64_t, uint64_t>> change_log;
+uint64_t change_log_start = 0;
+bool keep_change_log = false;
+
+// Last version given to any list. Versions are never reused, so that
+// they tell apart the states of all lists, even after reloading one.
+uint64_t version_clock = 0;
+
+// Order last computed by sort_tasks()
+SortCache sort_cache;
+
+// Memory mapping of the save file that loaded tasks borrow text from.
+// Snapshots share it, so that text they borrow stays valid after the
+// list lets go of the mapping.
+shared_ptr<MappedFile> save_file = make_shared<MappedFile>();
+
+// Format used by save_data()
+SaveFormat save_format = FORMAT_CSV;
+
+// Hash and size of the save file as it is on disk
+uint64_t save_file_hash = 0;
+size_t save_file_size = 0;
+
+// Set by retrieve_data() when the save file failed validation
+bool save_file_damaged = false;
+
+// Where problems found while loading a list are reported
+ostream *load_errors = &cerr;
+
+// Records of the save file, if it is CSV
+CsvLayout save_layout;
+
+// Writes the journal in the background during interactive use,
+// defined first so that it outlives the journal
+JournalWriter journal_writer;
+
+// Journal of changes not written to the save file yet
+Journal journal;
+
+// Paths of the save file and journal of the active list
+string data_path = DATA_PATH;
+string journal_path = JOURNAL_PATH;
+string archive_path = ARCHIVE_PATH;
+
+// Name of the active list
+string active_list = DEFAULT_LIST;
+
+// Loaded lists other than the active one, by name
+map<string, unique_ptr<TodoList>> parked_lists;
+
+// Incremented whenever a list is put aside, to tell which
+// list was used least recently
+uint64_t list_clock = 0;
+
+// Bytes that loaded lists may take up together
+size_t list_memory_budget = (size_t)LIST_MEMORY_BUDGET * 1024 * 1024;
+
+// Timings and counters of the work done
+Profile profile;
+
+// Number and total size of the memory allocations made
+atomic<uint64_t> allocation_count(0);
+atomic<uint64_t> allocated_bytes(0);
+
+// Every allocation goes through these, so that they can be counted.
+// Relaxed increments cost next to nothing next to malloc() itself.
+// The deletes stay out of line, or GCC pairs the free() inside them
+// with the standard operator new and warns of a mismatch.
+#if defined(__GNUC__)
+#define ALLOCATOR_NOINLINE __attribute__((noinline))
+#else
+#define ALLOCATOR_NOINLINE
+#endif
+
+void *operator new(size_t size)
+{
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    allocated_bytes.fetch_add(size, memory_order_relaxed);
+
+    if (size == 0)
+        size = 1;
+    for (;;)
+    {
+        if (void *memory = malloc(size))
+            return memory;
+
+        // Give the new handler a chance to free memory, as the
+        // standard operator new does
+        new_handler handler = get_new_handler();
+        if (handler == nullptr)
+            throw bad_alloc();
+        handler();
+    }
+}
+
+ALLOCATOR_NOINLINE void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+ALLOCATOR_NOINLINE void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+// Set by SIGINT and SIGTERM to stop the server
+volatile sig_atomic_t stop_requested = 0;
+
+// Where the profile is reported on exit, if anywhere
+bool print_stats = false;
+const char *trace_path = nullptr;
+
+// Whether commit_change() leaves committing to flush_changes(),
+// so that a whole batch of commands is written at once
+bool defer_commits = false;
+
+// Programs that embed the to-do list, such as the benchmark,
+// bring their own main()
+#ifndef TODOLIST_NO_MAIN
+// Main program loop
+int main(int argc, char *argv[]) 
+{
+    char command;
+
+    // Only iostreams are used for console output, so they do
+    // not need to be kept in step with C stdio
+    ios::sync_with_stdio(false);
+
+    // Options given on the command line
+    const char *format_option = nullptr;
+    const char *fsync_option = nullptr;
+    const char *import_path = nullptr;
+    const char *export_path = nullptr;
+    const char *list_option = nullptr;
+    const char *memory_option = nullptr;
+    const char *trace_option = nullptr;
+    const char *socket_option = nullptr;
+
+    // Position of the command to run without showing the menu, if any
+    int command_index = argc;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string option = argv[i];
+
+        // Options are followed by the command and its arguments
+        if (option.compare(0, 2, "--") != 0)
+        {
+            command_index = i;
+            break;
+        }
+
+        // Every option but --stats takes a value
+        if (option == "--stats")
+        {
+            print_stats = true;
+            continue;
+        }
+        if (i + 1 == argc)
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        if (option == "--format")
+            format_option = argv[++i];
+        else if (option == "--fsync")
+            fsync_option = argv[++i];
+        else if (option == "--import")
+            import_path = argv[++i];
+        else if (option == "--export")
+            export_path = argv[++i];
+        else if (option == "--list")
+            list_option = argv[++i];
+        else if (option == "--list-memory")
+            memory_option = argv[++i];
+        else if (option == "--trace")
+            trace_option = argv[++i];
+        else if (option == "--socket")
+            socket_option = argv[++i];
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (fsync_option != nullptr)
+    {
+        if (strcmp(fsync_option, "always") == 0)
+            journal.policy = FSYNC_ALWAYS;
+        else if (strcmp(fsync_option, "batch") == 0)
+            journal.policy = FSYNC_BATCH;
+        else if (strcmp(fsync_option, "never") == 0)
+            journal.policy = FSYNC_NEVER;
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Profiling starts before anything is loaded, so that loading is
+    // timed too, and is reported however the program exits
+    if (print_stats || trace_option != nullptr)
+    {
+        trace_path = trace_option;
+        profile.enable(trace_path != nullptr);
+        atexit(report_profile);
+    }
+
+    // Converting files does not involve any list,
+    // so none is loaded
+    if (command_index < argc && strcmp(argv[command_index], "convert") == 0)
+    {
+        vector<string> args(argv + command_index, argv + argc);
+        if (args.size() < 3 || args.size() % 2 == 0)
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        // Formats follow from file extensions, unless given
+        StreamFormat from = stream_format_of(args[1]);
+        StreamFormat to = stream_format_of(args[2]);
+        for (size_t i = 3; i < args.size(); i += 2)
+        {
+            if ((args[i] != "--from" || !parse_stream_format(args[i + 1], from)) &&
+                (args[i] != "--to" || !parse_stream_format(args[i + 1], to)))
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+
+        long long converted = convert_tasks(args[1], from, args[2], to);
+        if (converted == -1)
+            return 1;
+        if (args[2] != "-")
+            cout << "Converted " << converted << " task(s) to " << args[2] << endl;
+        return 0;
+    }
+
+    // Commands for a server run on the lists it has loaded,
+    // so none is loaded here
+    bool serving = command_index < argc && strcmp(argv[command_index], "serve") == 0;
+    if (socket_option != nullptr && command_index < argc && !serving)
+    {
+        if (list_option != nullptr && !is_list_name(list_option))
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        vector<string> args(argv + command_index, argv + argc);
+        if (args[0] == "batch" && args.size() > 2)
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        return run_remote(socket_option, list_option, args);
+    }
+
+    if (memory_option != nullptr)
+    {
+        size_t megabytes;
+        if (!parse_number(memory_option, megabytes))
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        list_memory_budget = megabytes * 1024 * 1024;
+    }
+
+    // Only the list that is worked on is loaded
+    if (list_option != nullptr)
+    {
+        if (!is_list_name(list_option))
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (!create_list_directory(list_option))
+            return 1;
+
+        active_list = list_option;
+        data_path = list_data_path(active_list);
+        journal_path = data_path + JOURNAL_SUFFIX;
+        archive_path = data_path + ARCHIVE_SUFFIX;
+    }
+
+    // Retrieve saved data from previous run, if any,
+    // followed by the changes made since it was saved
+    auto load = [] {
+        todo_items = retrieve_data();
+        if (save_file_damaged)
+            return;
+        index_tasks();
+        open_journal();
+    };
+
+    // The menu is shown while the list loads, nothing touches the
+    // list before the first choice is made. Problems are collected
+    // rather than printed over the menu.
+    bool interactive = command_index == argc && format_option == nullptr &&
+                       import_path == nullptr && export_path == nullptr;
+    ostringstream load_log;
+    thread loader;
+    if (interactive)
+    {
+        load_errors = &load_log;
+        loader = thread(load);
+    }
+    else
+    {
+        load();
+        if (save_file_damaged)
+            return 1;
+    }
+
+    // Keep the format the save file is in, unless asked otherwise
+    if (format_option != nullptr)
+    {
+        SaveFormat loaded_format = save_format;
+
+        if (strcmp(format_option, "csv") == 0)
+            save_format = FORMAT_CSV;
+        else if (strcmp(format_option, "binary") == 0)
+            save_format = FORMAT_BINARY;
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        // Convert the save file right away
+        if (save_format != loaded_format)
+        {
+            todo_items_dirty = true;
+            compact();
+        }
+    }
+
+    // Import and export run without showing the menu
+    if (import_path != nullptr || export_path != nullptr)
+    {
+        if (import_path != nullptr)
+        {
+            int imported = import_tasks(import_path);
+            if (imported == -1)
+            {
+                cerr << "Cannot import " << import_path << endl;
+                return 1;
+            }
+            cout << "Imported " << imported << " task(s) from " << import_path << endl;
+
+            // Write the imported tasks straight into the save file
+            compact();
+        }
+
+        if (export_path != nullptr)
+        {
+            if (!export_tasks(export_path))
+            {
+                cerr << "Cannot write " << export_path << endl;
+                return 1;
+            }
+            cout << "Exported " << todo_items.size() << " task(s) to " << export_path << endl;
+        }
+
+        journal.close();
+        return 0;
+    }
+
+    // Command mode: the list is loaded and saved only once,
+    // no matter how many commands are run
+    if (command_index < argc)
+    {
+        vector<string> args(argv + command_index, argv + argc);
+        bool succeeded;
+
+        defer_commits = true;
+        if (args[0] == "batch")
+        {
+            // Commands come from a file, or from standard input
+            if (args.size() > 2)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            if (args.size() == 1 || args[1] == "-")
+                succeeded = run_batch(cin) == 0;
+            else
+            {
+                ifstream file(args[1]);
+                if (!file)
+                {
+                    cerr << "Cannot open " << args[1] << endl;
+                    return 1;
+                }
+                succeeded = run_batch(file) == 0;
+            }
+        }
+        else if (serving)
+        {
+            if (args.size() > 1)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            succeeded = serve(socket_option != nullptr ? socket_option : SOCKET_PATH);
+        }
+        else
+            succeeded = run_command(args, cout, cerr);
+
+        flush_changes();
+        journal.close();
+        close_lists();
+        return succeeded ? 0 : 1;
+    }
+
+    // Clear screen on first run
+    clear_screen();
+
+    while (true)
+    {
+        // Show instructions
+        cout << "-To Do List-" << endl;
+        cout << "1. Add Task" << endl;
+        cout << "2. View Tasks" << endl;
+        cout << "3. Mark Task as Completed" << endl;
+        cout << "4. Edit Task" << endl;
+        cout << "5. Delete Task" << endl;
+        cout << "6. Exit" << endl << endl;
+
+        cout << "Enter a number 1-6: ";
+
+        if (loader.joinable())
+        {
+            cout << flush;
+            profile.record("first prompt", profile.start(), chrono::steady_clock::now());
+        }
+
+        while (true)
+        {
+            cin >> command;
+            // Flush stdin stream to remove input "residue".
+            // Only first character will be read, the rest 
+            // of the line will be discarded.
+            cin.ignore(INT_MAX, '\n');
+            if (command >= '1' && command <= '6')
+                break;
+            cout << "Invalid input. Please enter a number within range 1-6: ";
+        }
+
+        cout << endl;
+
+        // Changes of interactive commands are written in the background,
+        // once the list they apply to is there
+        bool first_choice = loader.joinable();
+        if (first_choice)
+        {
+            loader.join();
+            load_errors = &cerr;
+            if (save_file_damaged)
+            {
+                cerr << load_log.str();
+                return 1;
+            }
+            journal_writer.start();
+        }
+
+        clear_screen();
+
+        // Problems found while loading show above the first command
+        if (first_choice)
+            cerr << load_log.str();
+
+        // Map commands to main function calls
+        switch (command)
+        {
+            case '1':
+            {
+                ScopedTimer timer("add");
+                add();
+                break;
+            }
+            case '2':
+            {
+                ScopedTimer timer("view");
+                view();
+                break;
+            }
+            case '3':
+            {
+                ScopedTimer timer("mark");
+                mark();
+                break;
+            }
+            case '4':
+            {
+                ScopedTimer timer("edit");
+                edit();
+                break;
+            }
+            case '5':
+            {
+                ScopedTimer timer("remove");
+                remove();
+                break;
+            }
+            case '6':
+                // All changes are queued for the journal already, wait
+                // until they have reached the disk before termination
+                if (!journal.commit() || !journal.sync())
+                    cerr << "Error: could not write " << journal_path << endl;
+                journal.close();
+                journal_writer.stop();
+                close_lists();
+
+                // Closure of application
+                cout << "Thanks for using the application, have a nice day!" << endl;
+                cout << "Press enter to exit ...";
+                cin.ignore(INT_MAX, '\n');
+
+                // Cleanup
+                clear_screen();
+
+                // Terminate program
+                return 0;
+        }
+
+        // Writes of the persistence thread may have failed meanwhile
+        if (!journal.commit())
+            cerr << "Error: could not write " << journal_path << endl;
+
+        // Allow user to read the output before the program continues
+        cout << "\nPress enter to continue ...";
+        cin.ignore(INT_MAX, '\n');
+
+        // Remove clutter from previous output to improve readability
+        // and to focus on the next instructions
+        clear_screen();
+    }
+}
+#endif // TODOLIST_NO_MAIN
+
+void add()
+{
+    // Create object to store new task details
+    TodoItem task;
+    string title, description;
+
+    cout << "Enter task details (Empty to abort operation): " << endl;
+
+    // Title of new task
+    cout << "Title: ";
+    getline(cin, title);
+
+    // Allow user to back out of operation if they no longer 
+    // wish to continue
+    if (title.empty())
+    {
+        cout << "Abort task." << endl;
+        return;
+    }
+
+    // Description of new task
+    cout << "Description: ";
+    getline(cin, description);
+
+    // Due date of new task
+    cout << "Due Date (DD/MM/YYYY): ";
+    task.due_date = get_date_input();
+
+    task.title = move(title);
+    task.description = move(description);
+
+    // Add new task to todo_items vector
+    Change change;
+    change.type = CHANGE_ADD;
+    change.item = move(task);
+    commit_change(move(change));
+
+    cout << "Task added successfully" << endl;
+}
+
+void view()
+{
+    // Print title of output
+    cout << "All Tasks" << endl;
+
+    print_tasks(cout, todo_items);
+}
+
+void print_tasks(ostream &out, const TaskStore &items, size_t first, size_t count)
+{
+    // Output is collected here and written in chunks
+    string buffer;
+    buffer.reserve(VIEW_BUFFER_SIZE + 1024);
+
+    // Find the first task of the window. Unless tasks were removed
+    // since the store was last compacted, it is at index `first`.
+    size_t i = min(first, items.size());
+    if (items.removed_count() > 0)
+    {
+        for (i = 0; i < items.size(); i++)
+            if (!items.is_removed(i) && first-- == 0)
+                break;
+    }
+
+    // Iterate over the items and print their details
+    for (; i < items.size() && count > 0; i++)
+    {
+        if (items.is_removed(i))
+            continue;
+        append_task(buffer, items, i);
+        count--;
+
+        if (buffer.size() >= VIEW_BUFFER_SIZE)
+        {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    out.write(buffer.data(), buffer.size());
+}
+
+void print_task_list(ostream &out, const TaskStore &items, const TaskTable &slots,
+                     const vector<uint64_t> &ids)
+{
+    // Output is collected here and written in chunks
+    string buffer;
+    buffer.reserve(VIEW_BUFFER_SIZE + 1024);
+
+    for (uint64_t id : ids)
+    {
+        append_task(buffer, items, slots.find(id));
+
+        if (buffer.size() >= VIEW_BUFFER_SIZE)
+        {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    out.write(buffer.data(), buffer.size());
+}
+
+void append_task(string &out, const TaskStore &items, size_t position)
+{
+    // Task number is printed beside the title,
+    // padded to a width of 3 characters
+    char number[24];
+    char *number_end = to_chars(number, number + sizeof(number), items.id(position)).ptr;
+    out += '\n';
+    out.append(number, number_end);
+    if (number_end - number < 3)
+        out.append(3 - (number_end - number), ' ');
+
+    out += "Title: ";
+    out += items.title(position).view();
+    out += "\n   Desc: ";
+    out += items.description(position).view();
+    out += "\n   Due Date: ";
+    append_date(out, items.due_date(position));
+    out += "\n   Completed: ";
+    out += items.completed(position) ? "Yes\n" : "No\n";
+}
+
+void mark()
+{
+    // Prompt user for position of task in todo_item
+    // vector to be marked
+    int item_position = get_item_position("mark");
+
+    // Status code for operation abortion
+    if (item_position == -1)
+        return;
+
+    // Check if item is already marked before
+    if (todo_items.completed(item_position))
+        cout << "Task is already marked as completed." << endl;
+    else
+    {
+        // Change the state of .completed attribute
+        Change change;
+        change.type = CHANGE_MARK;
+        change.id = todo_items.id(item_position);
+        commit_change(move(change));
+        cout << "Task marked as completed." << endl;
+    }
+}
+
+void edit()
+{
+    // Prompt user for position of task in todo_item
+    // vector to be edited
+    int item_position = get_item_position("edit");
+
+    // Status code for operation abortion
+    if (item_position == -1)
+        return;
+        
+    // Details of the selected task are read in place
+    string title, description;
+    
+    cout << "Enter task details (Empty to abort operation): " << endl;
+
+    // Print initial title of task for user reference
+    cout << "Title " << "(was " << todo_items.title(item_position) <<  "): ";
+    getline(cin, title);
+
+    // Allow user to back out of operation if they no longer 
+    // wish to continue
+    if (title.empty())
+    {
+        cout << "Abort task." << endl;
+        return;
+    }
+
+    // Get updated decsription for selected task
+    cout << "Description: " << "(was " << todo_items.description(item_position) << "): ";
+    getline(cin, description);
+
+    // Get updated due date for selected task
+    cout << "Due Date (DD/MM/YYYY, was " << format_date(todo_items.due_date(item_position)) << "): ";
+
+    // Replace original task details with updated task details.
+    // Edited text is owned by the task from now on and
+    // no longer refers to the save file.
+    Change change;
+    change.type = CHANGE_EDIT;
+    change.id = todo_items.id(item_position);
+    change.item.title = title;
+    change.item.description = description;
+    change.item.due_date = get_date_input();
+    commit_change(move(change));
+
+    cout << "Task edited successfully" << endl;
+}
+
+void remove()
+{
+    // Prompt user for position of task in todo_item
+    // vector to be removed
+    int item_position = get_item_position("remove");
+
+    // Status code for operation abortion
+    if (item_position == -1)
+        return;
+
+    // Character to hold user's decision ([y]es or [n]o)
+    char choice;
+
+    // Prompts user to enter choice
+    cout << "Confirm to delete \"" << todo_items.title(item_position) << "\"? [y/n]: ";
+    cin >> choice;
+
+    // Consider both lower and upper case inputs
+    // Proceed as long as the choice starts with
+    // the 'y' character
+    if (choice == 'y' || choice == 'Y')
+    {
+        // Delete the selected task from todo_items vector
+        Change change;
+        change.type = CHANGE_REMOVE;
+        change.id = todo_items.id(item_position);
+        commit_change(move(change));
+        cout << "Task deleted successfully." << endl;
+    }
+    // Confirmation failed
+    else
+    {
+        cout << "Delete operation cancelled." << endl;
+    }
+
+    // Clear buffer for next input to prevent input issues
+    // (Ignore leftover input from this point)
+    cin.ignore(INT_MAX, '\n');
+}
+
+void clear_screen()
+{
+#ifdef __MINGW32__
+    // Only consoles can be cleared
+    static const bool is_terminal = _isatty(_fileno(stdout));
+    if (!is_terminal)
+        return;
+
+    // Output written so far has to appear before the screen is cleared
+    cout.flush();
+
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(console, &info))
+        return;
+
+    // Blank out the whole buffer and move the cursor to the top left
+    COORD origin = {0, 0};
+    DWORD cells = (DWORD)info.dwSize.X * info.dwSize.Y;
+    DWORD count;
+    FillConsoleOutputCharacterA(console, ' ', cells, origin, &count);
+    FillConsoleOutputAttribute(console, info.wAttributes, cells, origin, &count);
+    SetConsoleCursorPosition(console, origin);
+#else
+    // Only terminals understand escape sequences
+    static const bool is_terminal = isatty(STDOUT_FILENO);
+    if (!is_terminal)
+        return;
+
+    // Move cursor home, clear the screen and the scrollback buffer,
+    // the same sequence that `clear` prints
+    cout << "\x1b[H\x1b[2J\x1b[3J" << flush;
+#endif
+}
+
+int get_item_position(string_view action)
+{
+    // Hold user input for task number, which is the task's ID
+    long long input_num;
+
+    // Index of the task in todo_items
+    uint32_t position;
+
+    while (true)
+    {
+        // Print customised prompt
+        cout << "Enter task number to " << action << " (0 to abort operation): ";
+
+        cin >> input_num;
+        // Clear buffer to prevent input issues
+        cin.ignore(INT_MAX, '\n');
+
+        // If read successfully
+        if (cin)
+        {
+            // User chose to abort operation
+            if (input_num == 0)
+            {
+                cout << "Abort task." << endl;
+
+                // Return status code for operation abortion
+                return -1;
+            }
+
+            // Input number belongs to an existing task
+            position = input_num > 0 ? find_task(input_num) : TaskTable::npos;
+            if (position != TaskTable::npos)
+                break; // Move on to next step
+    
+            cout << "There is no task with this number." << endl;
+
+            // Continue prompting for input
+            continue;
+        }
+        // User entered non-numeric values
+        else 
+        {
+            // Clear error flag of cin
+            // to enable next input
+            cin.clear();
+
+            // Clear buffer
+            cin.ignore(INT_MAX, '\n');
+
+            // Inform user about incorrect input
+            cout << "What you've entered is not a number." << endl;
+
+            // Continue prompting for input
+            continue;
+        }
+    }
+
+    return (int)position;
+}
+
+bool is_valid_date(string_view date_str)
+{
+    // Same rules as the dates that are stored
+    return pack_date(date_str) != NO_DUE_DATE;
+}
+
+bool is_valid_day(int day, int month, int year)
+{
+    // Conditions: 
+    // 1. Year should not be a negative number
+    // 2. Month should be in range [1, 12]
+    // 3. Date should be over 0
+    // 4. Date should not exceed maximum days in that particular month
+    // 5. Rule 3, with an exception for second month if it is a leap year (28 -> 29)
+
+    if (year < 1) {
+        return false;
+    }
+
+    if (month < 1 || month > 12) {
+        return false;
+    }
+
+    // Array to match month with respective days
+    const int days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if (day < 1)
+        return false;
+
+    if (month == 2 && is_leap_year(year))
+    {
+        if (day > 29)
+            return false;
+    }
+    else
+    {
+        if (day > days_in_month[month - 1])
+            return false;
+    }
+
+    // Valid if all conditions are fulfilled
+    return true;
+}
+
+
+bool is_leap_year(int year)
+{
+    // Condition 1:
+    // Leap year if perfectly divisible by 400
+    // OR
+    // Condition 2:
+    // Leap year if not divisible by 100, AND
+    // Divisible by 4
+
+    if (year % 400 == 0)
+        return true;
+
+    else if (year % 100 != 0 && year % 4 == 0)
+        return true;
+
+    else
+        return false;
+}
+
+int32_t get_date_input()
+{
+    // Line buffer is kept between calls, so that
+    // reading a date does not allocate memory
+    static string date_str;
+
+    // Prompt until receives valid input
+    while (true)
+    {
+        // Get the whole line to parse
+        getline(cin, date_str);
+
+        // Validated and stored as a plain number of days in one go
+        int32_t date = pack_date(date_str);
+        if (date != NO_DUE_DATE)
+            return date;
+
+        // Prompt for reenter
+        cout << "Please enter a valid date: ";
+    }
+}
+
+int32_t today()
+{
+    time_t now = time(nullptr);
+    struct tm local;
+#ifdef __MINGW32__
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    return days_from_civil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+}
+
+int32_t days_from_civil(int year, int month, int day)
+{
+    // Proleptic Gregorian calendar, counted in eras of 400 years
+    // that start on 1 March so that leap days come last
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// Reads a number the way the %d conversion of sscanf does:
+// leading whitespace, an optional sign, then digits
+bool scan_number(const char *&p, const char *end, int &value)
+{
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-'))
+        negative = *p++ == '-';
+
+    // Numbers are limited to 9 digits so that they fit into an int
+    const char *digits = p;
+    int number = 0;
+    while (p < end && isdigit((unsigned char)*p))
+    {
+        if (p - digits == 9)
+            return false;
+        number = number * 10 + (*p++ - '0');
+    }
+
+    value = negative ? -number : number;
+    return p > digits;
+}
+
+// Reads whitespace followed by a slash, like " /" in a sscanf format
+bool scan_slash(const char *&p, const char *end)
+{
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    if (p == end || *p != '/')
+        return false;
+    p++;
+    return true;
+}
+
+int32_t pack_date(string_view date_str)
+{
+    const char *p = date_str.data();
+    const char *end = p + date_str.size();
+    int day, month, year;
+
+    // Same pattern as "%d /%d /%d", anything after the year is ignored
+    if (!scan_number(p, end, day) || !scan_slash(p, end) ||
+        !scan_number(p, end, month) || !scan_slash(p, end) ||
+        !scan_number(p, end, year) || !is_valid_day(day, month, year))
+        return NO_DUE_DATE;
+
+    return days_from_civil(year, month, day);
+}
+
+string format_date(int32_t days)
+{
+    string date;
+    append_date(date, days);
+    return date;
+}
+
+void append_date(string &out, int32_t days)
+{
+    if (days == NO_DUE_DATE)
+        return;
+
+    // Inverse of days_from_civil()
+    days += 719468;
+    int era = (days >= 0 ? days : days - 146096) / 146097;
+    int day_of_era = days - era * 146097;
+    int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int month_index = (5 * day_of_year + 2) / 153;
+    int day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    int month = month_index < 10 ? month_index + 3 : month_index - 9;
+    int year = year_of_era + era * 400 + (month <= 2);
+
+    // Layout users enter dates in, without leading zeros
+    char buffer[32];
+    char *p = to_chars(buffer, buffer + 10, day).ptr;
+    *p++ = '/';
+    p = to_chars(p, p + 10, month).ptr;
+    *p++ = '/';
+    p = to_chars(p, p + 10, year).ptr;
+    out.append(buffer, p - buffer);
+}
+
+string serialise_csv(const TaskStore &items, vector<uint64_t> *offsets)
+{
+    ostringstream contents;
+    if (offsets != nullptr)
+        offsets->clear();
+
+    // Loop through each item in todo_items
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        if (offsets != nullptr)
+            offsets->push_back((uint64_t)contents.tellp());
+        write_csv_task(contents, items[i]);
+    }
+
+    return contents.str();
+}
+
+void write_csv_task(ostream &out, const TodoItem &task)
+{
+    // Write item details in CSV format
+    // with each field enclosed in quotes
+    for_each_field([&](const auto &field, auto index) {
+        if (index > 0)
+            out << ",";
+        codec_of<decltype(field)>::write_csv(out, field.of(task));
+    });
+    out << "\n";  // Indicates end of line/single entry
+}
+
+// Helpers for little-endian numbers in binary snapshots
+void put_u32(string &out, uint32_t value)
+{
+    char bytes[4];
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (char)(value >> (8 * i));
+    out.append(bytes, 4);
+}
+
+void put_u64(string &out, uint64_t value)
+{
+    put_u32(out, (uint32_t)value);
+    put_u32(out, (uint32_t)(value >> 32));
+}
+
+uint32_t get_u32(const char *p)
+{
+    const unsigned char *bytes = (const unsigned char *)p;
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+           (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+uint64_t get_u64(const char *p)
+{
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+// 64-bit FNV-1a hash used as checksum. Passing the hash of preceding
+// data as `hash` continues hashing where it left off.
+uint64_t fnv1a(const char *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Hash identifying a CSV save file for its journal: the hash of the
+// hashes of its blocks, which are kept in `hashes`
+uint64_t hash_csv_blocks(const char *data, size_t size, vector<uint64_t> &hashes)
+{
+    hashes.resize((size + CSV_HASH_BLOCK_SIZE - 1) / CSV_HASH_BLOCK_SIZE);
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+        size_t start = i * CSV_HASH_BLOCK_SIZE;
+        hashes[i] = fnv1a(data + start, min((size_t)CSV_HASH_BLOCK_SIZE, size - start));
+    }
+    return fnv1a((const char *)hashes.data(), hashes.size() * sizeof(uint64_t));
+}
+
+void TextCodec::write_csv(ostream &out, const Text &value)
+{
+    write_csv_field(out, value.view());
+}
+
+void TextCodec::read_csv(const CsvField &field, Text &value, bool borrow, string *unescaped)
+{
+    // Referenced in place where possible
+    if (!field.escaped)
+    {
+        string_view text(field.data, field.size);
+        value = borrow ? Text::borrow(text) : Text(text);
+    }
+    else if (borrow && unescaped != nullptr)
+    {
+        assign_csv_field(*unescaped, field);
+        value = Text::borrow(*unescaped);
+    }
+    else
+    {
+        string text;
+        assign_csv_field(text, field);
+        value = text;
+    }
+}
+
+void TextCodec::write_json(string &out, const Text &value)
+{
+    write_json_string(out, value.view());
+}
+
+bool TextCodec::read_json(const char *&p, const char *end, Text &value, string &unescaped)
+{
+    string_view text;
+    if (!scan_json_string(p, end, unescaped, text))
+        return false;
+    value = Text::borrow(text);
+    return true;
+}
+
+void TextCodec::put(string &out, const Text &value)
+{
+    string_view text = value.view();
+    put_u32(out, (uint32_t)text.size());
+    out.append(text.data(), text.size());
+}
+
+void DateCodec::write_csv(ostream &out, int32_t value)
+{
+    write_csv_field(out, format_date(value));
+}
+
+void DateCodec::read_csv(const CsvField &field, int32_t &value, bool, string *)
+{
+    // Dates are kept as a number of days
+    value = pack_date(string_view(field.data, field.size));
+}
+
+void DateCodec::write_json(string &out, int32_t value)
+{
+    if (value == NO_DUE_DATE)
+    {
+        out += "null";
+        return;
+    }
+    out += '"';
+    append_date(out, value);
+    out += '"';
+}
+
+bool DateCodec::read_json(const char *&p, const char *end, int32_t &value, string &unescaped)
+{
+    if (skip_json_literal(p, end, "null"))
+        return true;
+
+    // Dates that cannot be understood are dropped, like in CSV files
+    string_view text;
+    if (!scan_json_string(p, end, unescaped, text))
+        return false;
+    value = pack_date(text);
+    return true;
+}
+
+void DateCodec::put(string &out, int32_t value)
+{
+    put_u32(out, (uint32_t)value);
+}
+
+int32_t DateCodec::get(const char *p)
+{
+    return (int32_t)get_u32(p);
+}
+
+void FlagCodec::write_csv(ostream &out, bool value)
+{
+    out << "\"" << value << "\"";
+}
+
+void FlagCodec::read_csv(const CsvField &field, bool &value, bool, string *)
+{
+    // Convert the string "1" or "0" to a boolean type in C++
+    value = field.size == 1 && field.data[0] == '1';
+}
+
+void FlagCodec::write_json(string &out, bool value)
+{
+    out += value ? "true" : "false";
+}
+
+bool FlagCodec::read_json(const char *&p, const char *end, bool &value, string &)
+{
+    if (skip_json_literal(p, end, "true"))
+        value = true;
+    else if (skip_json_literal(p, end, "false"))
+        value = false;
+    else
+        return false;
+    return true;
+}
+
+void IdCodec::write_csv(ostream &out, uint64_t value)
+{
+    out << "\"" << value << "\"";
+}
+
+void IdCodec::read_csv(const CsvField &field, uint64_t &value, bool, string *)
+{
+    // Tasks without a readable ID are given one once loaded
+    if (from_chars(field.data, field.data + field.size, value).ptr != field.data + field.size)
+        value = NO_TASK_ID;
+}
+
+void IdCodec::write_json(string &out, uint64_t value)
+{
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr - digits);
+}
+
+bool IdCodec::read_json(const char *&p, const char *end, uint64_t &value, string &)
+{
+    auto result = from_chars(p, end, value);
+    if (result.ec != errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+
+void IdCodec::put(string &out, uint64_t value)
+{
+    put_u64(out, value);
+}
+
+uint64_t IdCodec::get(const char *p)
+{
+    return get_u64(p);
+}
+
+const char *SnapshotBytes::take(size_t size)
+{
+    if ((size_t)(end - p) < size)
+        return nullptr;
+    const char *start = p;
+    p += size;
+    return start;
+}
+
+bool SnapshotBytes::text(size_t size, Text &value)
+{
+    const char *start = take(size);
+    if (start == nullptr)
+        return false;
+    value = Text::borrow(string_view(start, size));
+    return true;
+}
+
+template <typename Tasks>
+void put_snapshot_block(string &out, const Tasks &tasks, size_t first, size_t count)
+{
+    put_u32(out, (uint32_t)count);
+
+    // Numbers, a column per field
+    auto put_columns = [&](auto section) {
+        constexpr SnapshotSection wanted = decltype(section)::value;
+        for_each_field([&](const auto &field, auto) {
+            using Codec = codec_of<decltype(field)>;
+            if constexpr (Codec::section == wanted)
+                for (size_t i = first; i < first + count; i++)
+                    Codec::put(out, field_value(field, tasks, i));
+        });
+    };
+
+    put_columns(integral_constant<SnapshotSection, SECTION_IDS>());
+
+    // String table
+    for (size_t i = first; i < first + count; i++)
+        for_each_field([&](const auto &field, auto) {
+            using Codec = codec_of<decltype(field)>;
+            if constexpr (Codec::section == SECTION_TEXT)
+                Codec::put(out, field_value(field, tasks, i));
+        });
+
+    put_columns(integral_constant<SnapshotSection, SECTION_WORDS>());
+
+    // Bitsets
+    for_each_field([&](const auto &field, auto) {
+        using Codec = codec_of<decltype(field)>;
+        if constexpr (Codec::section == SECTION_BITS)
+        {
+            size_t bitset = out.size();
+            out.append((count + 7) / 8, '\0');
+            for (size_t i = 0; i < count; i++)
+                if (field_value(field, tasks, first + i))
+                    out[bitset + i / 8] |= (char)(1 << (i % 8));
+        }
+    });
+}
+
+template <typename Source>
+bool get_snapshot_block(Source &in, uint32_t version, size_t first, size_t count, TaskStore &items)
+{
+    bool intact = true;
+
+    // Numbers, a column per field
+    auto get_columns = [&](auto section) {
+        constexpr SnapshotSection wanted = decltype(section)::value;
+        for_each_field([&](const auto &field, auto) {
+            using Field = decay_t<decltype(field)>;
+            using Codec = typename Field::codec;
+            if constexpr (Codec::section == wanted)
+            {
+                if (!intact || field.since > version)
+                    return;
+                const char *p = in.take(count * Codec::width);
+                intact = p != nullptr;
+                for (size_t i = first; intact && i < first + count; i++, p += Codec::width)
+                    TaskColumn<Field::member>::set(items, i, Codec::get(p));
+            }
+        });
+    };
+
+    get_columns(integral_constant<SnapshotSection, SECTION_IDS>());
+
+    // String table
+    for (size_t i = first; intact && i < first + count; i++)
+        for_each_field([&](const auto &field, auto) {
+            using Field = decay_t<decltype(field)>;
+            if constexpr (Field::codec::section == SECTION_TEXT)
+            {
+                if (!intact || field.since > version)
+                    return;
+                const char *length = in.take(4);
+                Text text;
+                intact = length != nullptr && in.text(get_u32(length), text);
+                if (intact)
+                    TaskColumn<Field::member>::set(items, i, text);
+            }
+        });
+
+    get_columns(integral_constant<SnapshotSection, SECTION_WORDS>());
+
+    // Bitsets
+    for_each_field([&](const auto &field, auto) {
+        using Field = decay_t<decltype(field)>;
+        if constexpr (Field::codec::section == SECTION_BITS)
+        {
+            if (!intact || field.since > version)
+                return;
+            const char *bitset = in.take((count + 7) / 8);
+            intact = bitset != nullptr;
+            for (size_t i = 0; intact && i < count; i++)
+                TaskColumn<Field::member>::set(items, first + i, (bitset[i / 8] >> (i % 8)) & 1);
+        }
+    });
+
+    return intact;
+}
+
+string serialise_snapshot(const TaskStore &items, uint64_t next_id, const DueIndex *due)
+{
+    size_t blocks = (items.size() + SNAPSHOT_BLOCK_SIZE - 1) / SNAPSHOT_BLOCK_SIZE;
+    size_t indexes = due != nullptr && due->built() ? 1 : 0;
+    string out;
+
+    // Fills in a number once it is known
+    auto patch_u64 = [&out](size_t offset, uint64_t value) {
+        for (int i = 0; i < 8; i++)
+            out[offset + i] = (char)(value >> (8 * i));
+    };
+
+    // Header, with the tables filled in as blocks and indexes are written
+    out.append(SNAPSHOT_MAGIC, 8);
+    put_u32(out, SNAPSHOT_VERSION);
+    put_u32(out, SNAPSHOT_FLAG_INDEXED);
+    put_u64(out, items.size());
+    put_u64(out, next_id);
+    put_u32(out, (uint32_t)blocks);
+    put_u32(out, (uint32_t)indexes);
+    put_u64(out, 0);  // End of blocks
+    size_t block_table = out.size();
+    size_t index_table = block_table + blocks * SNAPSHOT_BLOCK_ENTRY_SIZE;
+    size_t header_size = index_table + indexes * SNAPSHOT_INDEX_ENTRY_SIZE;
+    out.append(header_size - block_table + 8, '\0');
+
+    for (size_t block = 0; block < blocks; block++)
+    {
+        size_t first = block * SNAPSHOT_BLOCK_SIZE;
+        size_t start = out.size();
+        put_snapshot_block(out, items, first, min((size_t)SNAPSHOT_BLOCK_SIZE, items.size() - first));
+        patch_u64(block_table + block * SNAPSHOT_BLOCK_ENTRY_SIZE, start);
+        patch_u64(block_table + block * SNAPSHOT_BLOCK_ENTRY_SIZE + 8,
+                  fnv1a(out.data() + start, out.size() - start));
+    }
+
+    // End of blocks
+    patch_u64(SNAPSHOT_HEADER_SIZE - 8, out.size());
+    put_u32(out, 0);
+
+    // Due index, in the order of its entries
+    if (indexes > 0)
+    {
+        size_t start = out.size();
+        for (const DueEntry &entry : due->all())
+        {
+            put_u32(out, (uint32_t)entry.due_date);
+            put_u64(out, entry.id);
+        }
+
+        string entry;
+        put_u32(entry, SNAPSHOT_INDEX_DUE);
+        put_u32(entry, 0);  // No flags defined yet
+        put_u64(entry, start);
+        put_u64(entry, out.size() - start);
+        put_u64(entry, fnv1a(out.data() + start, out.size() - start));
+        out.replace(index_table, entry.size(), entry);
+    }
+
+    // Checksum of the header, then of the whole snapshot
+    patch_u64(header_size, fnv1a(out.data(), header_size));
+    put_u64(out, fnv1a(out.data(), out.size()));
+
+    return out;
+}
+
+bool parse_indexed_snapshot(const char *data, size_t size, TaskStore &items, uint64_t &next_id,
+                            DueIndex *due)
+{
+    if (size < SNAPSHOT_HEADER_SIZE + 8 + 4 + SNAPSHOT_TRAILER_SIZE)
+        return false;
+
+    // Header and tables are trusted once their checksum matches
+    size_t body_size = size - SNAPSHOT_TRAILER_SIZE;
+    uint32_t version = get_u32(data + 8);
+    uint64_t total = get_u64(data + 16);
+    uint32_t blocks = get_u32(data + 32);
+    uint32_t indexes = get_u32(data + 36);
+    uint64_t blocks_end = get_u64(data + 40);
+    uint64_t index_table = SNAPSHOT_HEADER_SIZE + (uint64_t)blocks * SNAPSHOT_BLOCK_ENTRY_SIZE;
+    uint64_t header_size = index_table + (uint64_t)indexes * SNAPSHOT_INDEX_ENTRY_SIZE;
+    if (header_size + 8 > body_size || fnv1a(data, header_size) != get_u64(data + header_size))
+        return false;
+    if (blocks_end < header_size + 8 || blocks_end + 4 > body_size || get_u32(data + blocks_end) != 0)
+        return false;
+
+    // Blocks follow each other up to the end of blocks,
+    // each starting with its task count
+    vector<uint64_t> offsets(blocks + 1, blocks_end);
+    vector<size_t> firsts(blocks + 1, items.size());
+    for (size_t i = 0; i < blocks; i++)
+        offsets[i] = get_u64(data + SNAPSHOT_HEADER_SIZE + i * SNAPSHOT_BLOCK_ENTRY_SIZE);
+    for (size_t i = 0; i < blocks; i++)
+    {
+        if ((i == 0 && offsets[i] != header_size + 8) || offsets[i] + 4 > offsets[i + 1])
+            return false;
+        uint32_t count = get_u32(data + offsets[i]);
+        if (count == 0 || count > SNAPSHOT_BLOCK_SIZE)
+            return false;
+        firsts[i + 1] = firsts[i] + count;
+    }
+    if (firsts[blocks] - items.size() != total)
+        return false;
+    next_id = get_u64(data + 24);
+
+    auto read_blocks = [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; i++)
+        {
+            const char *start = data + offsets[i];
+            size_t length = offsets[i + 1] - offsets[i];
+            const char *entry = data + SNAPSHOT_HEADER_SIZE + i * SNAPSHOT_BLOCK_ENTRY_SIZE;
+            if (fnv1a(start, length) != get_u64(entry + 8))
+                return false;
+
+            SnapshotBytes in = { start + 4, start + length };
+            if (!get_snapshot_block(in, version, firsts[i], firsts[i + 1] - firsts[i], items) ||
+                in.p != in.end)
+                return false;
+        }
+        return true;
+    };
+
+    // Threads share no word of the completion bitset as long
+    // as each of them starts on a word boundary
+    items.resize(firsts[blocks]);
+    size_t threads = min((size_t)thread::hardware_concurrency(), (size_t)blocks / SNAPSHOT_THREAD_MIN_BLOCKS);
+    vector<size_t> starts(threads + 1, blocks);
+    for (size_t i = 0; i < threads; i++)
+    {
+        starts[i] = (size_t)blocks * i / threads;
+        if (firsts[starts[i]] % 64 != 0)
+            threads = 0;
+    }
+
+    bool intact = true;
+    if (threads <= 1)
+        intact = read_blocks(0, blocks);
+    else
+    {
+        vector<char> results(threads);
+        vector<thread> workers;
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([&, i] { results[i] = read_blocks(starts[i], starts[i + 1]); });
+        for (thread &worker : workers)
+            worker.join();
+        intact = count(results.begin(), results.end(), 0) == 0;
+    }
+    if (!intact)
+        return false;
+
+    // Prebuilt indexes lie between the end of blocks and the trailer
+    for (size_t i = 0; i < indexes; i++)
+    {
+        const char *entry = data + index_table + i * SNAPSHOT_INDEX_ENTRY_SIZE;
+        uint32_t kind = get_u32(entry);
+        uint64_t offset = get_u64(entry + 8);
+        uint64_t length = get_u64(entry + 16);
+        if (offset < blocks_end + 4 || offset > body_size || length > body_size - offset)
+            return false;
+
+        // Indexes of other kinds or that are damaged are built when needed
+        if (kind != SNAPSHOT_INDEX_DUE || due == nullptr || length % SNAPSHOT_DUE_ENTRY_SIZE != 0 ||
+            fnv1a(data + offset, length) != get_u64(entry + 24))
+            continue;
+
+        ScopedTimer timer("load due index");
+        vector<DueEntry> entries(length / SNAPSHOT_DUE_ENTRY_SIZE);
+        for (size_t j = 0; j < entries.size(); j++)
+        {
+            const char *p = data + offset + j * SNAPSHOT_DUE_ENTRY_SIZE;
+            entries[j] = { (int32_t)get_u32(p), get_u64(p + 4) };
+        }
+        if (is_sorted(entries.begin(), entries.end()))
+            due->adopt(move(entries));
+    }
+
+    return true;
+}
+
+bool is_snapshot(const char *data, size_t size)
+{
+    return size >= 8 && memcmp(data, SNAPSHOT_MAGIC, 8) == 0;
+}
+
+bool parse_snapshot(const char *data, size_t size, TaskStore &items, uint64_t &next_id,
+                    DueIndex *due)
+{
+    if (!is_snapshot(data, size) || size < SNAPSHOT_V1_HEADER_SIZE + 4 + SNAPSHOT_TRAILER_SIZE)
+        return false;
+
+    // Snapshots with tables are checked a block at a time
+    if (get_u32(data + 8) >= 3 && get_u32(data + 8) <= SNAPSHOT_VERSION &&
+        (get_u32(data + 12) & SNAPSHOT_FLAG_INDEXED))
+        return parse_indexed_snapshot(data, size, items, next_id, due);
+
+    // Verify checksum before trusting any of the contents
+    size_t body_size = size - SNAPSHOT_TRAILER_SIZE;
+    if (fnv1a(data, body_size) != get_u64(data + body_size))
+        return false;
+
+    // Snapshots written by newer versions cannot be understood
+    uint32_t version = get_u32(data + 8);
+    if (version > SNAPSHOT_VERSION)
+        return false;
+
+    // Tasks only have IDs since version 2, the header only has
+    // tables since version 3, which are empty without the flag
+    bool has_ids = version >= 2;
+    size_t header_size = version >= 3 ? SNAPSHOT_HEADER_SIZE + 8
+                         : has_ids ? SNAPSHOT_V2_HEADER_SIZE : SNAPSHOT_V1_HEADER_SIZE;
+    if (body_size < header_size + 4)
+        return false;
+    if (version >= 3 && (get_u32(data + 32) != 0 || get_u32(data + 36) != 0))
+        return false;
+
+    // Number of tasks expected in the blocks, unless streamed
+    bool streamed = get_u32(data + 12) & SNAPSHOT_FLAG_STREAMED;
+    uint64_t total = get_u64(data + 16);
+    size_t initial = items.size();
+    if (!streamed)
+        items.reserve(initial + total);
+    if (has_ids && !streamed)
+        next_id = get_u64(data + 24);
+
+    SnapshotBytes in = { data + header_size, data + body_size };
+    while (true)
+    {
+        const char *p = in.take(4);
+        if (p == nullptr)
+            return false;
+        uint32_t count = get_u32(p);
+
+        // End of blocks
+        if (count == 0)
+            break;
+
+        size_t first = items.size();
+        items.resize(first + count);
+        if (!get_snapshot_block(in, version, first, count, items))
+            return false;
+    }
+
+    // Nothing may follow the last block
+    return in.p == in.end && (streamed || items.size() - initial == total);
+}
+
+bool write_file(const char *path, const string &contents)
+{
+    // Create object for file output
+    ofstream fout;
+
+    // Open file for output, in overwrite mode
+    fout.open(path, ios::out | ios::binary);
+
+    // Write all data at once
+    fout.write(contents.data(), contents.size());
+    profile.bytes_written += contents.size();
+
+    // Close the file to ensure all data is written safely
+    // and release the resources
+    fout.close();
+
+    return !fout.fail();
+}
+
+bool write_all(int fd, const char *data, size_t size)
+{
+    profile.bytes_written += size;
+
+    // Writes may be cut short, continue until everything is written
+    while (size > 0)
+    {
+        auto result = ::write(fd, data, size);
+        if (result <= 0)
+            return false;
+        data += result;
+        size -= result;
+    }
+    return true;
+}
+
+bool replace_file(const char *path, const string &contents)
+{
+    // Temporary file lives next to the target, so
+    // that renaming does not cross file systems
+    string temp_path = string(path) + ".tmp";
+
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd == -1)
+        return false;
+
+    // New contents have to be on disk before they replace the old ones
+    bool written = write_all(fd, contents.data(), contents.size()) && fsync(fd) == 0;
+    written = ::close(fd) == 0 && written;
+    if (!written)
+    {
+        ::remove(temp_path.c_str());
+        return false;
+    }
+
+#ifdef __MINGW32__
+    if (!MoveFileExA(temp_path.c_str(), path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        ::remove(temp_path.c_str());
+        return false;
+    }
+#else
+    if (rename(temp_path.c_str(), path) == -1)
+    {
+        ::remove(temp_path.c_str());
+        return false;
+    }
+
+    // Persist the rename itself by syncing the containing directory
+    string directory(path);
+    size_t slash = directory.rfind('/');
+    directory = slash == string::npos ? "." : directory.substr(0, slash + 1);
+    int directory_fd = ::open(directory.c_str(), O_RDONLY);
+    if (directory_fd != -1)
+    {
+        fsync(directory_fd);
+        ::close(directory_fd);
+    }
+#endif
+
+    return true;
+}
+
+void save_data()
+{
+    // Nothing changed since the file was loaded or last saved
+    if (!todo_items_dirty)
+        return;
+
+    ScopedTimer timer("save_data");
+
+    // Marks and edits may not need the whole file rewritten
+    if (patch_save_file())
+    {
+        todo_items_dirty = false;
+        return;
+    }
+
+    // Removed tasks are not written
+    compact_tasks();
+
+    // Assemble the whole file in memory. Text borrowed from the
+    // mapping of the current save file is read while doing so.
+    vector<uint64_t> offsets;
+    string contents = save_format == FORMAT_BINARY
+                      ? serialise_snapshot(todo_items, next_task_id, &due_index)
+                      : serialise_csv(todo_items, &offsets);
+
+#ifdef __MINGW32__
+    // Windows refuses to replace a file that is still mapped
+    close_save_file();
+#endif
+
+    // Replace the save file of the active list. Elsewhere the
+    // mapping keeps referring to the previous version of the file.
+    if (!replace_file(data_path.c_str(), contents))
+    {
+        cerr << "Error: could not write " << data_path << endl;
+        return;
+    }
+
+    // Remember which version of the file the journal builds on
+    save_file_hash = save_format == FORMAT_CSV
+                     ? hash_csv_blocks(contents.data(), contents.size(), save_layout.hashes)
+                     : fnv1a(contents.data(), contents.size());
+    if (save_format != FORMAT_CSV)
+        save_layout.hashes.clear();
+    save_file_size = contents.size();
+    todo_items_dirty = false;
+
+    save_layout.offsets.swap(offsets);
+    save_layout.dirty.clear();
+    save_layout.edited = false;
+    save_layout.valid = save_format == FORMAT_CSV;
+
+    reclaim_text();
+}
+
+bool patch_save_file()
+{
+#ifdef __MINGW32__
+    // Mapped files cannot be written to on Windows
+    return false;
+#else
+    CsvLayout &layout = save_layout;
+    if (save_format != FORMAT_CSV || !layout.valid || layout.dirty.empty() ||
+        layout.offsets.size() != todo_items.size() || todo_items.removed_count() > 0)
+        return false;
+
+    // Snapshots may read the text of edited tasks from the mapping
+    if (layout.edited && save_file.use_count() > 1)
+        return false;
+
+    ScopedTimer timer("patch_save_file");
+    vector<uint32_t> &dirty = layout.dirty;
+    sort(dirty.begin(), dirty.end());
+    dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+
+    // Past a third of the tasks, rewriting the file is faster
+    if (dirty.size() > layout.offsets.size() / 3)
+        return false;
+
+    int fd = ::open(data_path.c_str(), O_RDWR | O_BINARY);
+    if (fd == -1)
+        return false;
+
+    // Every patch is worked out before anything is written
+    struct Patch {
+        uint64_t offset;
+        string bytes;
+    };
+    vector<Patch> patches;
+    ostringstream record;
+    string old_record;
+    bool patchable = true;
+    for (uint32_t position : dirty)
+    {
+        uint64_t begin = layout.offsets[position];
+        uint64_t end = position + 1 < layout.offsets.size() ? layout.offsets[position + 1] : save_file_size;
+
+        record.str("");
+        write_csv_task(record, todo_items[position]);
+        string new_record = record.str();
+
+        old_record.resize(end - begin);
+        if (new_record.size() != old_record.size() ||
+            pread(fd, &old_record[0], old_record.size(), begin) != (ssize_t)old_record.size())
+        {
+            patchable = false;
+            break;
+        }
+
+        // Fields of both records have to start and end at the same places
+        CsvRecord old_fields, new_fields;
+        const char *old_next, *new_next;
+        const char *old_data = old_record.data(), *new_data = new_record.data();
+        size_t size = new_record.size();
+        if (scan_csv_record(old_data, old_data + size, true, old_fields, old_next) != CSV_RECORD ||
+            scan_csv_record(new_data, new_data + size, true, new_fields, new_next) != CSV_RECORD ||
+            old_next != old_data + size || new_next != new_data + size ||
+            old_fields.count != new_fields.count)
+        {
+            patchable = false;
+            break;
+        }
+        for (size_t i = 0; i < new_fields.count && patchable; i++)
+            patchable = old_fields.fields[i].data - old_data == new_fields.fields[i].data - new_data &&
+                        old_fields.fields[i].size == new_fields.fields[i].size &&
+                        old_fields.fields[i].escaped == new_fields.fields[i].escaped;
+        if (!patchable)
+            break;
+
+        // Only the bytes that differ are written
+        size_t first = 0, last = size;
+        while (first < last && old_record[first] == new_record[first])
+            first++;
+        while (last > first && old_record[last - 1] == new_record[last - 1])
+            last--;
+        if (first < last)
+            patches.push_back({begin + first, new_record.substr(first, last - first)});
+    }
+
+    if (!patchable || (!patches.empty() && !journal.begin_patch()))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    bool written = true;
+    for (const Patch &patch : patches)
+    {
+        const char *data = patch.bytes.data();
+        size_t size = patch.bytes.size();
+        uint64_t offset = patch.offset;
+        while (written && size > 0)
+        {
+            ssize_t result = pwrite(fd, data, size, offset);
+            written = result > 0;
+            if (written)
+            {
+                data += result;
+                size -= result;
+                offset += result;
+            }
+        }
+        profile.bytes_written += patch.bytes.size();
+    }
+
+    // Identify the patched file for the journal, hashing
+    // only the blocks that were written to again
+    vector<uint64_t> &hashes = layout.hashes;
+    written = written && hashes.size() == (save_file_size + CSV_HASH_BLOCK_SIZE - 1) / CSV_HASH_BLOCK_SIZE;
+    if (written && !patches.empty())
+    {
+        vector<char> buffer(CSV_HASH_BLOCK_SIZE);
+        size_t hashed = SIZE_MAX;
+        for (const Patch &patch : patches)
+        {
+            size_t from = patch.offset / CSV_HASH_BLOCK_SIZE;
+            size_t to = (patch.offset + patch.bytes.size() - 1) / CSV_HASH_BLOCK_SIZE;
+            for (size_t block = max(from, hashed + 1); written && block <= to; block++)
+            {
+                size_t start = block * CSV_HASH_BLOCK_SIZE;
+                size_t size = min((size_t)CSV_HASH_BLOCK_SIZE, save_file_size - start);
+                written = pread(fd, buffer.data(), size, start) == (ssize_t)size;
+                hashes[block] = fnv1a(buffer.data(), size);
+                hashed = block;
+            }
+        }
+        written = written && fsync(fd) == 0;
+    }
+    written = ::close(fd) == 0 && written;
+
+    // A failed patch is made good by rewriting the whole file
+    if (!written)
+        return false;
+
+    if (!patches.empty())
+        save_file_hash = fnv1a((const char *)hashes.data(), hashes.size() * sizeof(uint64_t));
+    dirty.clear();
+    layout.edited = false;
+    return true;
+#endif
+}
+
+TaskStore retrieve_data()
+{
+    ScopedTimer timer("retrieve_data");
+
+    // Create object to store all tasks as a list
+    TaskStore items;
+
+    // Indexes of another list are of no use, a snapshot may bring its own
+    due_index.clear();
+    save_file_damaged = false;
+
+    // A missing file simply yields no records
+    save_file_hash = fnv1a(nullptr, 0);
+    save_file_size = 0;
+    save_layout = CsvLayout();
+    if (!save_file->open(data_path.c_str()))
+        return items;
+
+    const char *p = save_file->data();
+    const char *end = p + save_file->size();
+    save_file_size = save_file->size();
+
+    // Binary snapshot
+    if (is_snapshot(p, save_file->size()))
+    {
+        save_format = FORMAT_BINARY;
+        if (!parse_snapshot(p, save_file->size(), items, next_task_id, &due_index))
+        {
+            // Callers refuse to continue rather than overwriting
+            // the damaged file with an empty list on exit
+            *load_errors << "Error: " << data_path << " is damaged and cannot be loaded" << endl;
+            save_file_damaged = true;
+            return TaskStore();
+        }
+
+        // The verified checksum already covers all but the trailer
+        const char *trailer = end - SNAPSHOT_TRAILER_SIZE;
+        save_file_hash = fnv1a(trailer, SNAPSHOT_TRAILER_SIZE, get_u64(trailer));
+        profile.rows_parsed += items.size();
+        profile.bytes_read += save_file_size;
+        return items;
+    }
+
+    // Identify this version of the file for the journal,
+    // while the file is being parsed
+    thread hasher([p, end] { save_file_hash = hash_csv_blocks(p, end - p, save_layout.hashes); });
+
+    // CSV file: scan the mapped file directly and
+    // let the tasks refer to their text inside the mapping
+    save_format = FORMAT_CSV;
+    int malformed = parse_csv(p, end, true, items, &save_layout.offsets);
+    save_layout.valid = save_layout.offsets.size() == items.size();
+
+    hasher.join();
+
+    // Let the user know that some of the saved data was unreadable
+    if (malformed > 0)
+        *load_errors << "Warning: skipped " << malformed
+                     << " malformed line(s) in " << data_path << endl;
+
+    profile.rows_parsed += items.size();
+    profile.bytes_read += save_file_size;
+
+    // Return the list of retrieved items
+    return items;
+}
+
+StreamFormat stream_format_of(const string &path)
+{
+    auto has_extension = [&path](const char *extension) {
+        size_t size = strlen(extension);
+        return path.size() > size && path.compare(path.size() - size, size, extension) == 0;
+    };
+
+    if (has_extension(".jsonl"))
+        return STREAM_JSONL;
+    if (has_extension(".snap"))
+        return STREAM_SNAPSHOT;
+    return STREAM_CSV;
+}
+
+bool parse_stream_format(const string &name, StreamFormat &format)
+{
+    if (name == "csv")
+        format = STREAM_CSV;
+    else if (name == "jsonl")
+        format = STREAM_JSONL;
+    else if (name == "binary")
+        format = STREAM_SNAPSHOT;
+    else
+        return false;
+    return true;
+}
+
+int import_tasks(const char *path)
+{
+    ScopedTimer timer("import");
+    size_t first = todo_items.size();
+    int malformed = 0;
+
+    StreamFormat format = stream_format_of(path);
+    if (format == STREAM_CSV)
+    {
+        MappedFile file;
+        if (!file.open(path))
+            return -1;
+
+        // The file is closed again, so text has to be copied
+        malformed = parse_csv(file.data(), file.data() + file.size(), false, todo_items);
+    }
+    else
+    {
+        ifstream in(path, ios::binary);
+        if (!in)
+            return -1;
+
+        // Nothing is imported from a damaged file, so
+        // tasks are only added once all of them were read
+        TaskReader reader(in, format);
+        TaskStore imported;
+        TodoItem task;
+        while (reader.next(task))
+        {
+            // Text only lasts until the next task is read
+            task.title.materialise();
+            task.description.materialise();
+            imported.push_back(task);
+        }
+        if (reader.damaged())
+            return -1;
+
+        todo_items.append(imported);
+        malformed = reader.malformed();
+    }
+    int imported = (int)(todo_items.size() - first);
+    profile.rows_parsed += imported;
+
+    // Imported tasks are new to this list, whatever ID they had
+    for (size_t i = first; i < todo_items.size(); i++)
+    {
+        todo_items.set_id(i, next_task_id++);
+        task_slots.insert(todo_items.id(i), i);
+    }
+    if (imported > 0)
+    {
+        todo_items_dirty = true;
+        todo_items_version = ++version_clock;
+        save_layout.valid = false;
+
+        // Snapshots are taken again rather than catching up
+        change_log.clear();
+        change_log_start = todo_items_version;
+    }
+
+    if (malformed > 0)
+        cerr << "Warning: skipped " << malformed
+             << " malformed line(s) in " << path << endl;
+
+    // Imported tasks are picked up when the indexes are needed next
+    due_index.clear();
+    search_index.clear();
+
+    return imported;
+}
+
+bool export_tasks(const char *path)
+{
+    ScopedTimer timer("export");
+    compact_tasks();
+
+    ofstream out(path, ios::out | ios::binary);
+    if (!out)
+        return false;
+
+    TaskWriter writer(out, stream_format_of(path), todo_items.size(), next_task_id);
+    for (size_t i = 0; i < todo_items.size(); i++)
+        writer.write(todo_items[i]);
+    if (!writer.finish())
+        return false;
+
+    profile.bytes_written += out.tellp();
+    out.close();
+    return !out.fail();
+}
+
+long long convert_tasks(const string &input, StreamFormat from,
+                        const string &output, StreamFormat to)
+{
+    // Standard streams stand in for files named -
+    ifstream input_file;
+    istream *in = &cin;
+    if (input != "-")
+    {
+        input_file.open(input, ios::binary);
+        if (!input_file)
+        {
+            cerr << "Cannot open " << input << endl;
+            return -1;
+        }
+        in = &input_file;
+    }
+
+    ofstream output_file;
+    ostream *out = &cout;
+    if (output != "-")
+    {
+        output_file.open(output, ios::out | ios::binary);
+        if (!output_file)
+        {
+            cerr << "Cannot write " << output << endl;
+            return -1;
+        }
+        out = &output_file;
+    }
+
+    ScopedTimer timer("convert");
+
+    // Each task is written before the next one is read,
+    // keeping the IDs it has
+    TaskReader reader(*in, from);
+    TaskWriter writer(*out, to);
+    TodoItem task;
+    long long converted = 0;
+    while (reader.next(task))
+    {
+        writer.write(task);
+        converted++;
+    }
+    bool written = writer.finish();
+    profile.rows_parsed += converted;
+
+    if (reader.malformed() > 0)
+        cerr << "Warning: skipped " << reader.malformed()
+             << " malformed record(s) in " << input << endl;
+
+    if (reader.damaged())
+    {
+        cerr << "Error: " << input << " is damaged" << endl;
+        return -1;
+    }
+    if (!written)
+    {
+        cerr << "Cannot write " << output << endl;
+        return -1;
+    }
+    return converted;
+}
+
+void print_usage(const char *program)
+{
+    cerr << "Usage: " << program << " [options] [command]" << endl
+         << endl
+         << "Without a command, the interactive menu is shown." << endl
+         << endl
+         << "Commands:" << endl
+         << "  add --title TITLE [--desc TEXT] --due DD/MM/YYYY" << endl
+         << "                       Add a task" << endl
+         << "  mark N               Mark task N as completed" << endl
+         << "  mark|remove [IDS] [--completed] [--due-before DD/MM/YYYY]" << endl
+         << "                       Mark or delete all tasks that match, where" << endl
+         << "                       IDS is a set of task numbers like 1,4,9-12" << endl
+         << "  edit N [--title TITLE] [--desc TEXT] [--due DD/MM/YYYY]" << endl
+         << "                       Change the details of task N" << endl
+         << "  remove N             Delete task N" << endl
+         << "  view [--page N] [--page-size K] [--sort KEY,...]" << endl
+         << "                       Print all tasks, or only page N of K tasks" << endl
+         << "                       (default page size: " << VIEW_PAGE_SIZE << "), sorted by" << endl
+         << "                       due, completed and title in the order given" << endl
+         << "  overdue              Print incomplete tasks due before today" << endl
+         << "  week                 Print incomplete tasks due in the next " << WEEK_DAYS << " days" << endl
+         << "  next [N]             Print the next N incomplete tasks due from" << endl
+         << "                       today on (default: " << NEXT_COUNT << ")" << endl
+         << "  stats                Print the number of tasks that are completed," << endl
+         << "                       incomplete, overdue and due this week" << endl
+         << "  search WORD... [--archive]" << endl
+         << "                       Print tasks containing words starting with" << endl
+         << "                       every WORD in their title or description," << endl
+         << "                       also looking through the archive if asked to" << endl
+         << "  archive [--before DD/MM/YYYY]" << endl
+         << "                       Move completed tasks due before the date" << endl
+         << "                       (default: " << ARCHIVE_AGE << " days ago) into the archive" << endl
+         << "  history [--page N] [--page-size K]" << endl
+         << "                       Print archived tasks" << endl
+         << "  use NAME             Run the following commands of a batch on" << endl
+         << "                       list NAME, which is loaded on first use" << endl
+         << "  lists                Print all lists, marking the active one" << endl
+         << "  batch [FILE]         Run commands from FILE, or from standard" << endl
+         << "                       input, one per line" << endl
+         << "  serve                Keep lists loaded and run the commands of" << endl
+         << "                       clients connecting to the socket (default: " << SOCKET_PATH << ")" << endl
+         << "  convert IN OUT [--from FORMAT] [--to FORMAT]" << endl
+         << "                       Convert tasks between csv, jsonl and binary" << endl
+         << "                       files, or standard input and output for -," << endl
+         << "                       without loading any list. Formats follow from" << endl
+         << "                       .csv, .jsonl and .snap extensions if not given" << endl
+         << endl
+         << "Options:" << endl
+         << "  --format csv|binary  Format to save the list in" << endl
+         << "                       (default: format the file is already in)" << endl
+         << "  --fsync always|batch|never" << endl
+         << "                       When journal writes are forced to disk" << endl
+         << "                       (default: always)" << endl
+         << "  --import FILE        Add the tasks of a .csv, .jsonl or .snap file" << endl
+         << "                       and exit" << endl
+         << "  --export FILE        Write all tasks to a .csv, .jsonl or .snap" << endl
+         << "                       file and exit" << endl
+         << "  --list NAME          Work on list NAME, saved in " << LIST_DIRECTORY << endl
+         << "                       (default: " << DEFAULT_LIST << ", saved in " << DATA_PATH << ")" << endl
+         << "  --list-memory MB     Memory loaded lists may take up before the" << endl
+         << "                       least recently used are unloaded" << endl
+         << "                       (default: " << LIST_MEMORY_BUDGET << ")" << endl
+         << "  --stats              Print the time taken by each command and" << endl
+         << "                       operation, and the work done, on exit" << endl
+         << "  --trace FILE         Write the operations to FILE on exit, in the" << endl
+         << "                       trace format of chrome://tracing" << endl
+         << "  --socket PATH        Socket to serve on, or to send the command to" << endl
+         << "                       a server on instead of loading the list" << endl;
+}
+
+int parse_csv(const char *begin, const char *end, bool borrow, TaskStore &items,
+              vector<uint64_t> *offsets)
+{
+    size_t size = end - begin;
+    size_t threads = min((size_t)thread::hardware_concurrency(), size / CSV_THREAD_MIN_SIZE);
+
+    // Small input is not worth starting threads for
+    if (threads <= 1)
+    {
+        int malformed = 0;
+        parse_csv_range(begin, end, end, borrow, items, malformed, offsets, begin);
+        return malformed;
+    }
+
+    // Count quotes in every range, to know whether a range
+    // starts inside a quoted field
+    vector<const char *> starts(threads + 1);
+    vector<size_t> quotes(threads);
+    for (size_t i = 0; i <= threads; i++)
+        starts[i] = begin + size / threads * i;
+    starts[threads] = end;
+
+    vector<thread> workers;
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back([&, i] { quotes[i] = count(starts[i], starts[i + 1], '"'); });
+    for (thread &worker : workers)
+        worker.join();
+    workers.clear();
+
+    // Move each start past the next newline outside quotes. Quotes
+    // passed on the way belong to the same range, so the counts of
+    // earlier ranges still tell the state at the next range.
+    size_t quotes_before = 0;
+    for (size_t i = 1; i < threads; i++)
+    {
+        quotes_before += quotes[i - 1];
+
+        // A record reaching past this range leaves it empty
+        if (starts[i - 1] >= starts[i])
+        {
+            starts[i] = starts[i - 1];
+            continue;
+        }
+
+        bool quoted = quotes_before % 2 == 1;
+        const char *p = starts[i];
+        for (; p < end && (quoted || *p != '\n'); p++)
+            if (*p == '"')
+                quoted = !quoted;
+        starts[i] = p < end ? p + 1 : end;
+    }
+
+    // Parse the ranges, each with its own text arena
+    vector<TaskStore> parsed(threads);
+    vector<TextArena> arenas(threads);
+    vector<vector<uint64_t>> range_offsets(offsets != nullptr ? threads : 0);
+    vector<const char *> stops(threads);
+    vector<int> malformed(threads, 0);
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back([&, i] {
+            thread_arena = &arenas[i];
+            stops[i] = parse_csv_range(starts[i], starts[i + 1], end, borrow,
+                                       parsed[i], malformed[i],
+                                       offsets != nullptr ? &range_offsets[i] : nullptr, begin);
+        });
+    for (thread &worker : workers)
+        worker.join();
+
+    // Every range has to end exactly where the next one starts
+    bool aligned = true;
+    for (size_t i = 0; i < threads; i++)
+        aligned = aligned && stops[i] == starts[i + 1];
+    if (!aligned)
+    {
+        int count = 0;
+        parse_csv_range(begin, end, end, borrow, items, count, offsets, begin);
+        return count;
+    }
+
+    for (TextArena &arena : arenas)
+        text_arena.absorb(arena);
+
+    // Concatenate the results in order
+    size_t total = items.size();
+    int malformed_total = 0;
+    for (size_t i = 0; i < threads; i++)
+    {
+        total += parsed[i].size();
+        malformed_total += malformed[i];
+    }
+
+    items.reserve(total);
+    for (const TaskStore &range : parsed)
+        items.append(range);
+    for (const vector<uint64_t> &range : range_offsets)
+        offsets->insert(offsets->end(), range.begin(), range.end());
+
+    return malformed_total;
+}
+
+const char *parse_csv_range(const char *begin, const char *stop, const char *end,
+                            bool borrow, TaskStore &items, int &malformed,
+                            vector<uint64_t> *offsets, const char *origin)
+{
+    const char *p = begin;
+    CsvRecord record;
+    CsvStatus status;
+
+    while (p < stop)
+    {
+        const char *start = p;
+        status = scan_csv_record(p, end, true, record, p);
+        if (status == CSV_BLANK)
+            continue;
+
+        // Skip lines that do not hold a complete task rather
+        // than adding an empty task to the list
+        TodoItem item;
+        if (status != CSV_RECORD || !record_to_item(record, item, borrow))
+        {
+            malformed++;
+            continue;
+        }
+
+        // Add item to the end of items list
+        items.push_back(item);
+        if (offsets != nullptr)
+            offsets->push_back(start - origin);
+    }
+
+    return p;
+}
+
+bool record_to_item(const CsvRecord &record, TodoItem &item, bool borrow,
+                    string *unescaped)
+{
+    // Tasks saved before a field was added lack it
+    if (record.count < CSV_REQUIRED_FIELDS || record.count > TASK_FIELD_COUNT)
+        return false;
+
+    // Fields that are left out keep their defaults; tasks
+    // without an ID are given one once loaded
+    item = TodoItem();
+    for_each_field([&](const auto &field, auto index) {
+        if (index < record.count)
+            codec_of<decltype(field)>::read_csv(record.fields[index], field.of(item), borrow,
+                                                unescaped != nullptr ? &unescaped[index] : nullptr);
+    });
+
+    return true;
+}
+
+void close_save_file()
+{
+    if (!save_file->is_open())
+        return;
+
+    // Copy text out of the mapping before it disappears
+    for (size_t i = 0; i < todo_items.size(); i++)
+    {
+        todo_items.title(i).materialise();
+        todo_items.description(i).materialise();
+    }
+
+    // Snapshots may still use the mapping, the last one unmaps it
+    save_file = make_shared<MappedFile>();
+}
+
+CsvStatus scan_csv_record(const char *begin, const char *end, bool at_eof,
+                          CsvRecord &record, const char *&next)
+{
+    const char *p = begin;
+    record.count = 0;
+
+    // An empty line holds no record
+    if (p < end && (*p == '\n' || *p == '\r'))
+    {
+        if (*p == '\r')
+        {
+            if (p + 1 == end && !at_eof)
+                return CSV_INCOMPLETE;
+            if (p + 1 < end && p[1] == '\n')
+                p++;
+        }
+        next = p + 1;
+        return CSV_BLANK;
+    }
+
+    // Set when the record holds more fields than expected
+    bool overflow = false;
+
+    // Each iteration scans a single field followed by its separator
+    while (true)
+    {
+        CsvField field = {p, 0, false};
+
+        if (p < end && *p == '"')
+        {
+            // Quoted field: runs until a quote that is not doubled
+            field.data = ++p;
+            while (true)
+            {
+                // Jump straight to the next quote character
+                const char *quote = (const char *)memchr(p, '"', end - p);
+
+                // Quote was never closed
+                if (quote == nullptr)
+                {
+                    if (!at_eof)
+                        return CSV_INCOMPLETE;
+                    next = end;
+                    return CSV_MALFORMED;
+                }
+
+                // Cannot tell yet whether the quote is doubled
+                if (quote + 1 == end && !at_eof)
+                    return CSV_INCOMPLETE;
+
+                // Doubled quote stands for a literal quote character
+                if (quote + 1 < end && quote[1] == '"')
+                {
+                    field.escaped = true;
+                    p = quote + 2;
+                    continue;
+                }
+
+                // Closing quote
+                field.size = quote - field.data;
+                p = quote + 1;
+                break;
+            }
+        }
+        else
+        {
+            // Unquoted field: runs until the next separator
+            while (p < end && *p != ',' && *p != '\n')
+                p++;
+            if (p == end && !at_eof)
+                return CSV_INCOMPLETE;
+            field.size = p - field.data;
+
+            // Drop carriage return of Windows line endings
+            if (field.size > 0 && field.data[field.size - 1] == '\r')
+                field.size--;
+        }
+
+        // Store field, as long as there is room for it
+        if (record.count < TASK_FIELD_COUNT)
+            record.fields[record.count] = field;
+        else
+            overflow = true;
+        record.count++;
+
+        // Last record in the input has no trailing newline
+        if (p == end)
+        {
+            next = end;
+            return overflow ? CSV_MALFORMED : CSV_RECORD;
+        }
+
+        // More fields follow
+        if (*p == ',')
+        {
+            p++;
+            continue;
+        }
+
+        // Allow Windows line endings after a quoted field
+        if (*p == '\r')
+        {
+            if (p + 1 == end && !at_eof)
+                return CSV_INCOMPLETE;
+            if (p + 1 < end && p[1] == '\n')
+                p++;
+        }
+
+        // End of record
+        if (*p == '\n')
+        {
+            next = p + 1;
+            return overflow ? CSV_MALFORMED : CSV_RECORD;
+        }
+
+        // Unexpected characters after a closing quote,
+        // skip the rest of the line
+        const char *newline = (const char *)memchr(p, '\n', end - p);
+        if (newline == nullptr)
+        {
+            if (!at_eof)
+                return CSV_INCOMPLETE;
+            next = end;
+        }
+        else
+            next = newline + 1;
+        return CSV_MALFORMED;
+    }
+}
+
+CsvReader::CsvReader(istream &in) : in(in), buffer(CSV_BLOCK_SIZE)
+{
+}
+
+CsvStatus CsvReader::next(CsvRecord &record)
+{
+    while (true)
+    {
+        // Everything has been consumed
+        if (start == filled && eof)
+            return CSV_END;
+
+        const char *next;
+        CsvStatus status = scan_csv_record(buffer.data() + start,
+                                           buffer.data() + filled,
+                                           eof, record, next);
+
+        if (status != CSV_INCOMPLETE)
+        {
+            // Move past the scanned record
+            start = next - buffer.data();
+            if (status == CSV_BLANK)
+                continue;
+            return status;
+        }
+
+        // Move the partial record to the front of the buffer
+        // to make room for the next block
+        size_t remaining = filled - start;
+        memmove(buffer.data(), buffer.data() + start, remaining);
+        start = 0;
+        filled = remaining;
+
+        // Grow buffer for records larger than a block
+        if (filled == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        // Read next block from the stream
+        in.read(buffer.data() + filled, buffer.size() - filled);
+        filled += in.gcount();
+        if (!in)
+            eof = true;
+    }
+}
+
+void assign_csv_field(string &out, const CsvField &field)
+{
+    // Plain fields can be copied as they are
+    if (!field.escaped)
+    {
+        out.assign(field.data, field.size);
+        return;
+    }
+
+    // Collapse each doubled quote into a single quote
+    out.clear();
+    out.reserve(field.size);
+    for (size_t i = 0; i < field.size; i++)
+    {
+        out += field.data[i];
+        if (field.data[i] == '"')
+            i++;
+    }
+}
+
+void write_csv_field(ostream &out, string_view value)
+{
+    out << '"';
+
+    // Fast path for values without quotes
+    if (value.find('"') == string_view::npos)
+        out << value;
+    else
+    {
+        for (char c : value)
+        {
+            if (c == '"')
+                out << '"';
+            out << c;
+        }
+    }
+
+    out << '"';
+}
+
+Text Text::borrow(string_view view)
+{
+    Text text;
+    text.characters = view;
+    text.is_borrowed = true;
+    return text;
+}
+
+Text::Text(string_view value) : characters(thread_arena->store(value)) {}
+
+void Text::materialise()
+{
+    if (!is_borrowed)
+        return;
+    characters = thread_arena->store(characters);
+    is_borrowed = false;
+}
+
+void Text::relocate(TextArena &arena)
+{
+    if (!is_borrowed)
+        characters = arena.store(characters);
+}
+
+string_view TextArena::store(string_view text)
+{
+    if (text.empty())
+        return string_view();
+
+    char *target;
+    if (text.size() > TEXT_CHUNK_SIZE / 4)
+    {
+        // Long text gets a chunk of its own, so that the
+        // space left in the current chunk is not wasted
+        chunks.emplace_back(new char[text.size()]);
+        target = chunks.back().get();
+    }
+    else
+    {
+        // Start a new chunk once the current one is full
+        if (text.size() > left)
+        {
+            chunks.emplace_back(new char[TEXT_CHUNK_SIZE]);
+            next = chunks.back().get();
+            left = TEXT_CHUNK_SIZE;
+        }
+        target = next;
+        next += text.size();
+        left -= text.size();
+    }
+
+    memcpy(target, text.data(), text.size());
+    total += text.size();
+    return string_view(target, text.size());
+}
+
+void TextArena::absorb(TextArena &other)
+{
+    // Chunks stay where they are, so text keeps referring to them
+    for (auto &chunk : other.chunks)
+        chunks.push_back(move(chunk));
+    total += other.total;
+
+    other.chunks.clear();
+    other.next = nullptr;
+    other.left = 0;
+    other.total = 0;
+}
+
+void TextArena::share(vector<shared_ptr<char[]>> &owners) const
+{
+    owners.insert(owners.end(), chunks.begin(), chunks.end());
+}
+
+void TextArena::swap(TextArena &other)
+{
+    chunks.swap(other.chunks);
+    std::swap(next, other.next);
+    std::swap(left, other.left);
+    std::swap(total, other.total);
+}
+
+ostream &operator<<(ostream &out, const Text &text)
+{
+    return out << text.view();
+}
+
+bool MappedFile::open(const char *path)
+{
+    close();
+
+#ifdef __MINGW32__
+    // Open file and create a read-only mapping object for it
+    file_handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size))
+    {
+        close();
+        return read(path);
+    }
+    length = (size_t)file_size.QuadPart;
+
+    // Empty files cannot be mapped, but there is nothing to read anyway
+    if (length > 0)
+    {
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY,
+                                            0, 0, nullptr);
+        if (mapping_handle == nullptr)
+        {
+            close();
+            return read(path);
+        }
+
+        base = (const char *)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        if (base == nullptr)
+        {
+            close();
+            return read(path);
+        }
+        mapped = true;
+    }
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    // Only regular files can be mapped
+    struct stat info;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode))
+    {
+        ::close(fd);
+        return read(path);
+    }
+    length = (size_t)info.st_size;
+
+    // Empty files cannot be mapped, but there is nothing to read anyway
+    if (length > 0)
+    {
+        void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            ::close(fd);
+            length = 0;
+            return read(path);
+        }
+        base = (const char *)mapping;
+        mapped = true;
+
+        // File is scanned from front to back while loading
+        madvise(mapping, length, MADV_SEQUENTIAL);
+    }
+
+    // The mapping stays valid after its descriptor is closed
+    ::close(fd);
+#endif
+
+    opened = true;
+    return true;
+}
+
+bool MappedFile::read(const char *path)
+{
+    close();
+
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file)
+        return false;
+
+    // Read the whole file at once
+    contents.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(contents.data(), contents.size());
+    if (!file)
+    {
+        contents.clear();
+        return false;
+    }
+
+    base = contents.data();
+    length = contents.size();
+    opened = true;
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef __MINGW32__
+    if (mapped)
+        UnmapViewOfFile(base);
+    if (mapping_handle != nullptr)
+        CloseHandle(mapping_handle);
+    if (file_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle);
+    mapping_handle = nullptr;
+    file_handle = INVALID_HANDLE_VALUE;
+#else
+    if (mapped)
+        munmap((void *)base, length);
+#endif
+
+    // Drop contents in case the file was read rather than mapped
+    contents.clear();
+    contents.shrink_to_fit();
+
+    base = nullptr;
+    length = 0;
+    opened = false;
+    mapped = false;
+}
+
+bool apply_change(const Change &change)
+{
+    if (change.id == NO_TASK_ID)
+        return false;
+
+    // Every change other than add refers to an existing task
+    uint32_t position = find_task(change.id);
+    if (change.type == CHANGE_ADD ? position != TaskTable::npos : position == TaskTable::npos)
+        return change.type == CHANGE_ADD || change.type == CHANGE_REMOVE;
+
+    switch (change.type)
+    {
+        case CHANGE_ADD:
+        {
+            TodoItem task = change.item;
+            task.id = change.id;
+            task_slots.insert(task.id, todo_items.size());
+            todo_items.push_back(task);
+            next_task_id = max(next_task_id, task.id + 1);
+            due_index.insert(task);
+            search_index.insert(task);
+            save_layout.valid = false;
+            break;
+        }
+        case CHANGE_MARK:
+            due_index.erase(todo_items[position]);
+            todo_items.set_completed(position, true);
+            mark_dirty(position, false);
+            break;
+        case CHANGE_EDIT:
+        {
+            // Completion state is not part of an edit
+            TodoItem task = todo_items[position];
+            due_index.erase(task);
+            search_index.erase(task);
+            task.title = change.item.title;
+            task.description = change.item.description;
+            task.due_date = change.item.due_date;
+            todo_items.title(position) = task.title;
+            todo_items.description(position) = task.description;
+            todo_items.set_due_date(position, task.due_date);
+            due_index.insert(task);
+            search_index.insert(task);
+            mark_dirty(position, true);
+            break;
+        }
+        case CHANGE_REMOVE:
+        {
+            // Task is only marked as removed, so that no other task moves
+            TodoItem task = todo_items[position];
+            due_index.erase(task);
+            search_index.erase(task);
+            task_slots.erase(task.id);
+            todo_items.remove(position);
+            save_layout.valid = false;
+
+            // Drop removed tasks once they take up half of the list
+            size_t removed = todo_items.removed_count();
+            if (removed >= TASK_COMPACT_MIN && removed * 2 >= todo_items.size())
+                compact_tasks();
+            break;
+        }
+        default:
+            return false;
+    }
+
+    todo_items_dirty = true;
+    todo_items_version = ++version_clock;
+    log_change(change.id);
+    return true;
+}
+
+void mark_dirty(uint32_t position, bool edited)
+{
+    CsvLayout &layout = save_layout;
+    if (!layout.valid)
+        return;
+
+    // Past one change per task, rewriting the file is cheaper
+    if (layout.dirty.size() >= layout.offsets.size())
+    {
+        layout.valid = false;
+        return;
+    }
+    layout.dirty.push_back(position);
+    layout.edited = layout.edited || edited;
+}
+
+void commit_change(Change change)
+{
+    ScopedTimer timer("commit_change");
+    if (change.type == CHANGE_ADD)
+        change.id = next_task_id;
+
+    journal.append(change);
+    apply_change(change);
+
+    if (!defer_commits)
+        flush_changes();
+}
+
+size_t commit_bulk(ChangeType type, const vector<uint32_t> &positions)
+{
+    ScopedTimer timer("commit_bulk");
+    vector<uint64_t> ids;
+    ids.reserve(positions.size());
+
+    for (uint32_t position : positions)
+    {
+        if (todo_items.is_removed(position) || (type == CHANGE_MARK && todo_items.completed(position)))
+            continue;
+
+        Change change;
+        change.type = type;
+        change.id = todo_items.id(position);
+        journal.append(change);
+        ids.push_back(change.id);
+
+        // The ID table is rebuilt by the compaction below
+        if (type == CHANGE_MARK)
+        {
+            todo_items.set_completed(position, true);
+            mark_dirty(position, false);
+        }
+        else
+            todo_items.remove(position);
+    }
+
+    if (ids.empty())
+        return 0;
+
+    // Indexes are updated once for all tasks
+    sort(ids.begin(), ids.end());
+    due_index.erase(ids);
+    if (type == CHANGE_REMOVE)
+    {
+        search_index.erase(ids);
+        save_layout.valid = false;
+        compact_tasks();
+    }
+
+    todo_items_dirty = true;
+    todo_items_version = ++version_clock;
+    for (uint64_t id : ids)
+        log_change(id);
+
+    if (!defer_commits)
+        flush_changes();
+    return ids.size();
+}
+
+void flush_changes()
+{
+    ScopedTimer timer("flush_changes");
+    if (!journal.commit())
+        cerr << "Error: could not write " << journal_path << endl;
+
+    // Fold the journal into the save file before it grows too large
+    if (needs_compaction())
+        compact();
+}
+
+// Helpers for variable-sized journal fields
+void put_text(string &out, string_view text)
+{
+    put_u32(out, (uint32_t)text.size());
+    out.append(text.data(), text.size());
+}
+
+bool get_text(const char *&p, const char *end, Text &text)
+{
+    if (end - p < 4)
+        return false;
+    uint32_t length = get_u32(p);
+    p += 4;
+    if ((size_t)(end - p) < length)
+        return false;
+    text = string_view(p, length);
+    p += length;
+    return true;
+}
+
+void encode_change(string &out, const Change &change)
+{
+    // Payload: change type, followed by its fields
+    string payload;
+    payload += (char)change.type;
+
+    put_u64(payload, change.id);
+
+    if (change.type == CHANGE_ADD || change.type == CHANGE_EDIT)
+    {
+        put_text(payload, change.item.title.view());
+        put_text(payload, change.item.description.view());
+        put_u32(payload, (uint32_t)change.item.due_date);
+    }
+
+    // Length and checksum protect against torn writes
+    put_u32(out, (uint32_t)payload.size());
+    put_u32(out, (uint32_t)fnv1a(payload.data(), payload.size()));
+    out += payload;
+}
+
+bool decode_change(const char *data, size_t size, uint32_t version, Change &change)
+{
+    const char *p = data;
+    const char *end = data + size;
+
+    if (p == end)
+        return false;
+    change.type = (ChangeType)*p++;
+    if (change.type < CHANGE_ADD || change.type > CHANGE_REMOVE)
+        return false;
+
+    if (version >= 2)
+    {
+        if (end - p < 8)
+            return false;
+        change.id = get_u64(p);
+        p += 8;
+    }
+    else if (change.type == CHANGE_ADD)
+        change.id = next_task_id;
+    else
+    {
+        // Position among the tasks as they are at this point of the replay
+        if (end - p < 4)
+            return false;
+        uint32_t position = get_u32(p);
+        p += 4;
+
+        compact_tasks();
+        if (position < todo_items.size())
+            change.id = todo_items.id(position);
+    }
+
+    if (change.type == CHANGE_ADD || change.type == CHANGE_EDIT)
+    {
+        if (!get_text(p, end, change.item.title) ||
+            !get_text(p, end, change.item.description) || end - p < 4)
+            return false;
+        change.item.due_date = (int32_t)get_u32(p);
+        p += 4;
+    }
+
+    return p == end;
+}
+
+size_t open_journal()
+{
+    ScopedTimer timer("open_journal");
+    MappedFile file;
+    size_t valid_size = 0;
+    size_t replayed = 0;
+    uint32_t version = JOURNAL_VERSION;
+
+    // Journal must start with a header for the loaded save file,
+    // otherwise its changes are already part of the save file. Older
+    // journals name the hash of the whole CSV file instead. Patching
+    // the save file in place changes its hash, so a journal flagged
+    // before is replayed anyway; its records may be applied twice.
+    if (file.read(journal_path.c_str()) && file.size() >= JOURNAL_HEADER_SIZE &&
+        memcmp(file.data(), JOURNAL_MAGIC, 8) == 0 &&
+        get_u32(file.data() + 8) <= JOURNAL_VERSION &&
+        (get_u64(file.data() + 16) == save_file_hash ||
+         (get_u32(file.data() + 12) & JOURNAL_FLAG_PATCHING) != 0 ||
+         (save_format == FORMAT_CSV && !(get_u32(file.data() + 12) & JOURNAL_FLAG_BLOCK_HASH) &&
+          get_u64(file.data() + 16) == fnv1a(save_file->data(), save_file->size()))))
+    {
+        version = get_u32(file.data() + 8);
+
+        const char *p = file.data() + JOURNAL_HEADER_SIZE;
+        const char *end = file.data() + file.size();
+
+        while (end - p >= 8)
+        {
+            // Stop at a record that was not written completely
+            uint32_t length = get_u32(p);
+            uint32_t checksum = get_u32(p + 4);
+            if ((size_t)(end - p - 8) < length ||
+                (uint32_t)fnv1a(p + 8, length) != checksum)
+                break;
+
+            Change change;
+            if (!decode_change(p + 8, length, version, change) || !apply_change(change))
+                break;
+
+            p += 8 + length;
+            replayed++;
+        }
+
+        valid_size = p - file.data();
+        profile.rows_parsed += replayed;
+        profile.bytes_read += file.size();
+    }
+
+    if (!journal.open(journal_path.c_str(), save_file_hash, valid_size))
+        *load_errors << "Error: could not open " << journal_path << endl;
+
+    // Records of older versions cannot be mixed with new ones,
+    // so their changes are moved into the save file
+    if (version < JOURNAL_VERSION)
+        compact();
+
+    return replayed;
+}
+
+void compact()
+{
+    ScopedTimer timer("compact");
+    journal.commit();
+
+    // Journal may only be emptied once its changes are in the save file
+    save_data();
+    if (todo_items_dirty)
+        return;
+
+    if (!journal.reset(save_file_hash))
+        cerr << "Error: could not reset " << journal_path << endl;
+}
+
+bool needs_compaction()
+{
+    return journal.size() > max((size_t)JOURNAL_COMPACT_SIZE, save_file_size / 2);
+}
+
+bool Journal::open(const char *path, uint64_t base_hash, size_t valid_size)
+{
+    close();
+    this->path = path;
+    this->base_hash = base_hash;
+    written = 0;
+
+    // New journals are only created once there is something to
+    // record, so that a session without changes writes nothing
+    if (valid_size == 0)
+        return true;
+
+    fd = ::open(path, O_WRONLY | O_BINARY);
+    if (fd == -1)
+        return false;
+
+    // Drop whatever an interrupted write left behind
+    // and continue after the last intact record
+    if (ftruncate(fd, valid_size) == -1 || lseek(fd, valid_size, SEEK_SET) == -1)
+    {
+        close();
+        return false;
+    }
+
+    written = valid_size;
+    last_sync = chrono::steady_clock::now();
+    return true;
+}
+
+void Journal::append(const Change &change)
+{
+    encode_change(pending, change);
+
+    // Write large groups without waiting for the caller to commit
+    if (pending.size() >= JOURNAL_GROUP_SIZE)
+        commit();
+}
+
+bool Journal::commit()
+{
+    // Records are handed to the persistence thread, which reports
+    // failed writes with the next commit
+    if (journal_writer.running())
+    {
+        bool healthy = !journal_writer.failed();
+        if (pending.empty())
+            return healthy;
+        if (fd == -1 && !create())
+            return false;
+
+        written += pending.size();
+        journal_writer.push(fd, move(pending), policy, false);
+        pending.clear();
+        unsynced = true;
+        return healthy;
+    }
+
+    // Nothing to write
+    if (pending.empty())
+        return true;
+
+    if (fd == -1 && !create())
+        return false;
+
+    // Write the whole group at once
+    if (!write_all(fd, pending.data(), pending.size()))
+        return false;
+
+    written += pending.size();
+    pending.clear();
+    unsynced = true;
+
+    // Force records to disk according to policy
+    switch (policy)
+    {
+        case FSYNC_ALWAYS:
+            return sync();
+        case FSYNC_BATCH:
+            if (chrono::steady_clock::now() - last_sync >= chrono::milliseconds(JOURNAL_SYNC_INTERVAL))
+                return sync();
+            return true;
+        default:
+            return true;
+    }
+}
+
+bool Journal::sync()
+{
+    if (!unsynced)
+        return true;
+    if (fd == -1)
+        return false;
+
+    last_sync = chrono::steady_clock::now();
+    if (journal_writer.running())
+    {
+        // Waits for the records queued before, and their fsync
+        journal_writer.push(fd, string(), policy, true);
+        journal_writer.drain();
+        if (journal_writer.failed())
+            return false;
+    }
+    else if (fsync(fd) == -1)
+        return false;
+
+    unsynced = false;
+    return true;
+}
+
+bool Journal::reset(uint64_t base_hash)
+{
+    this->base_hash = base_hash;
+    pending.clear();
+    return create();
+}
+
+bool Journal::begin_patch()
+{
+    if (!commit() || !sync() || fd == -1)
+        return false;
+
+    // Flags are rewritten in place, records go on after the last one
+    string flags;
+    put_u32(flags, JOURNAL_FLAG_PATCHING | JOURNAL_FLAG_BLOCK_HASH);
+    if (lseek(fd, 12, SEEK_SET) == -1)
+        return false;
+    bool written = write_all(fd, flags.data(), flags.size()) && fsync(fd) == 0;
+    return lseek(fd, this->written, SEEK_SET) != -1 && written;
+}
+
+bool Journal::create()
+{
+    // Queued records must not end up in the new file
+    if (journal_writer.running())
+        journal_writer.drain();
+
+    if (fd != -1)
+        ::close(fd);
+    written = 0;
+    unsynced = false;
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd == -1)
+        return false;
+
+    // Header naming the save file the records apply to
+    string header(JOURNAL_MAGIC, 8);
+    put_u32(header, JOURNAL_VERSION);
+    put_u32(header, JOURNAL_FLAG_BLOCK_HASH);
+    put_u64(header, base_hash);
+
+    // Header has to be on disk before any record relies on it
+    if (!write_all(fd, header.data(), header.size()) || fsync(fd) == -1)
+        return false;
+
+    written = header.size();
+    last_sync = chrono::steady_clock::now();
+    return true;
+}
+
+void Journal::close()
+{
+    commit();
+    sync();
+    if (fd != -1)
+        ::close(fd);
+    fd = -1;
+}
+
+void Journal::swap(Journal &other)
+{
+    std::swap(policy, other.policy);
+    std::swap(fd, other.fd);
+    path.swap(other.path);
+    std::swap(base_hash, other.base_hash);
+    pending.swap(other.pending);
+    std::swap(written, other.written);
+    std::swap(unsynced, other.unsynced);
+    std::swap(last_sync, other.last_sync);
+}
+
+void JournalWriter::start()
+{
+    if (running())
+        return;
+    stopping = false;
+    worker = thread(&JournalWriter::run, this);
+}
+
+void JournalWriter::stop()
+{
+    if (!running())
+        return;
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void JournalWriter::push(int fd, string bytes, FsyncPolicy policy, bool sync)
+{
+    // Wait for a free slot if the thread fell behind
+    uint64_t position = tail.load(memory_order_relaxed);
+    while (position - head.load(memory_order_acquire) == JOURNAL_QUEUE_SIZE)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            wake.notify_one();
+        }
+        this_thread::yield();
+    }
+
+    Write &write = ring[position % JOURNAL_QUEUE_SIZE];
+    write.fd = fd;
+    write.bytes = move(bytes);
+    write.policy = policy;
+    write.sync = sync;
+    tail.store(position + 1);
+
+    // Only a sleeping thread needs waking up
+    if (idle.load())
+    {
+        lock_guard<mutex> guard(lock);
+        wake.notify_one();
+    }
+}
+
+void JournalWriter::drain()
+{
+    uint64_t target = tail.load();
+    unique_lock<mutex> guard(lock);
+    urgent = true;
+    wake.notify_one();
+    finished.wait(guard, [&] { return done >= target; });
+}
+
+void JournalWriter::run()
+{
+    using clock = chrono::steady_clock;
+
+    // Records gathered for one file, not written yet
+    string buffer;
+    int buffer_fd = -1;
+    FsyncPolicy buffer_policy = FSYNC_ALWAYS;
+    clock::time_point gathered;
+
+    // Last file written with batched fsyncs that still needs one
+    int unsynced_fd = -1;
+    clock::time_point last_sync = clock::now();
+
+    auto sync = [&](int fd) {
+        last_sync = clock::now();
+        if (fsync(fd) == -1)
+            failures = true;
+        if (fd == unsynced_fd)
+            unsynced_fd = -1;
+    };
+
+    auto write_buffer = [&] {
+        if (buffer.empty())
+            return;
+        if (!write_all(buffer_fd, buffer.data(), buffer.size()))
+            failures = true;
+        else if (buffer_policy == FSYNC_ALWAYS)
+            sync(buffer_fd);
+        else if (buffer_policy == FSYNC_BATCH)
+        {
+            if (unsynced_fd != -1 && unsynced_fd != buffer_fd)
+                sync(unsynced_fd);
+            unsynced_fd = buffer_fd;
+        }
+        buffer.clear();
+    };
+
+    uint64_t position = head.load(memory_order_relaxed);
+    while (true)
+    {
+        // Drains are noticed before the writes they wait for are taken
+        bool flush = urgent.exchange(false);
+        bool stop = stopping.load();
+        uint64_t end = tail.load(memory_order_acquire);
+
+        for (; position < end; position++)
+        {
+            Write &write = ring[position % JOURNAL_QUEUE_SIZE];
+            if (write.fd != buffer_fd)
+                write_buffer();
+            if (buffer.empty())
+                gathered = clock::now();
+
+            buffer_fd = write.fd;
+            buffer_policy = write.policy;
+            buffer += write.bytes;
+            write.bytes = string();
+            if (write.sync)
+            {
+                write_buffer();
+                sync(buffer_fd);
+            }
+            head.store(position + 1, memory_order_release);
+        }
+
+        clock::time_point now = clock::now();
+        if (flush || stop || buffer.size() >= JOURNAL_GROUP_SIZE ||
+            now - gathered >= chrono::milliseconds(JOURNAL_COALESCE_INTERVAL))
+            write_buffer();
+
+        if (unsynced_fd != -1 && now - last_sync >= chrono::milliseconds(JOURNAL_SYNC_INTERVAL))
+            sync(unsynced_fd);
+
+        // Files may be closed once a drain returns
+        if (flush)
+            unsynced_fd = -1;
+
+        unique_lock<mutex> guard(lock);
+        if (buffer.empty())
+        {
+            done = end;
+            finished.notify_all();
+        }
+        if (stop && buffer.empty() && position == tail.load())
+            break;
+
+        // Sleep until more writes arrive or gathered records are due
+        idle = true;
+        if (tail.load() == position && !urgent && !stopping)
+        {
+            if (!buffer.empty())
+                wake.wait_until(guard, gathered + chrono::milliseconds(JOURNAL_COALESCE_INTERVAL));
+            else if (unsynced_fd != -1)
+                wake.wait_until(guard, last_sync + chrono::milliseconds(JOURNAL_SYNC_INTERVAL));
+            else
+                wake.wait(guard);
+        }
+        idle = false;
+    }
+
+    if (unsynced_fd != -1)
+        sync(unsynced_fd);
+}
+
+void lz_compress(const char *data, size_t size, string &out)
+{
+    const unsigned char *in = (const unsigned char *)data;
+    auto read32 = [in](size_t position) {
+        uint32_t value;
+        memcpy(&value, in + position, 4);
+        return value;
+    };
+    auto hash = [](uint32_t value) { return (value * 2654435761u) >> (32 - LZ_HASH_BITS); };
+    auto put_length = [&out](size_t length) {
+        for (; length >= 255; length -= 255)
+            out += (char)255;
+        out += (char)length;
+    };
+
+    // Last position of every hashed sequence, plus one
+    vector<uint32_t> table((size_t)1 << LZ_HASH_BITS, 0);
+    size_t anchor = 0, i = 0;
+
+    while (i + LZ_MIN_MATCH <= size)
+    {
+        uint32_t value = read32(i);
+        uint32_t &slot = table[hash(value)];
+        size_t candidate = slot;
+        slot = (uint32_t)(i + 1);
+
+        // Runs without matches are skipped faster the longer they get
+        if (candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET || read32(candidate - 1) != value)
+        {
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+        candidate--;
+
+        size_t length = LZ_MIN_MATCH;
+        while (i + length < size && in[candidate + length] == in[i + length])
+            length++;
+
+        size_t literals = i - anchor;
+        size_t match = length - LZ_MIN_MATCH;
+        size_t offset = i - candidate;
+        out += (char)((min(literals, (size_t)15) << 4) | min(match, (size_t)15));
+        if (literals >= 15)
+            put_length(literals - 15);
+        out.append(data + anchor, literals);
+        out += (char)(offset & 255);
+        out += (char)(offset >> 8);
+        if (match >= 15)
+            put_length(match - 15);
+
+        i += length;
+        anchor = i;
+    }
+
+    // Whatever is left goes out as literals
+    size_t literals = size - anchor;
+    out += (char)(min(literals, (size_t)15) << 4);
+    if (literals >= 15)
+        put_length(literals - 15);
+    out.append(data + anchor, literals);
+}
+
+bool lz_decompress(const char *data, size_t size, size_t raw_size, string &out)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + size;
+    size_t start = out.size();
+    out.reserve(start + raw_size);
+
+    auto get_length = [&p, end](size_t &length) {
+        if (length < 15)
+            return true;
+        while (p < end)
+        {
+            unsigned char byte = *p++;
+            length += byte;
+            if (byte != 255)
+                return true;
+        }
+        return false;
+    };
+
+    while (p < end)
+    {
+        unsigned char token = *p++;
+        size_t literals = token >> 4;
+        if (!get_length(literals) || (size_t)(end - p) < literals ||
+            out.size() - start + literals > raw_size)
+            return false;
+        out.append((const char *)p, literals);
+        p += literals;
+
+        // Only the last sequence has no match
+        if (p == end)
+            break;
+
+        if (end - p < 2)
+            return false;
+        size_t offset = p[0] | (size_t)p[1] << 8;
+        p += 2;
+        size_t length = token & 15;
+        if (!get_length(length))
+            return false;
+        length += LZ_MIN_MATCH;
+
+        size_t produced = out.size() - start;
+        if (offset == 0 || offset > produced || produced + length > raw_size)
+            return false;
+
+        // Matches may overlap the bytes they produce
+        size_t from = out.size() - offset;
+        for (size_t k = 0; k < length; k++)
+            out += out[from + k];
+    }
+
+    return out.size() - start == raw_size;
+}
+
+bool Archive::open(const string &path)
+{
+    index.clear();
+    next_task = 1;
+
+    // No archive is an empty one
+    if (!file.open(path.c_str()))
+        return !ifstream(path);
+
+    const char *data = file.data();
+    size_t size = file.size();
+    if (size < ARCHIVE_HEADER_SIZE + ARCHIVE_TRAILER_SIZE ||
+        memcmp(data, ARCHIVE_MAGIC, 8) != 0 || get_u32(data + 8) > ARCHIVE_VERSION ||
+        memcmp(data + size - 8, ARCHIVE_END_MAGIC, 8) != 0)
+        return false;
+
+    const char *trailer = data + size - ARCHIVE_TRAILER_SIZE;
+    uint64_t index_offset = get_u64(trailer);
+    uint32_t count = get_u32(trailer + 8);
+    uint32_t checksum = get_u32(trailer + 12);
+    next_task = get_u64(trailer + 16);
+    if (index_offset < ARCHIVE_HEADER_SIZE ||
+        index_offset + (uint64_t)count * ARCHIVE_ENTRY_SIZE != size - ARCHIVE_TRAILER_SIZE ||
+        (uint32_t)fnv1a(data + index_offset, (size_t)count * ARCHIVE_ENTRY_SIZE) != checksum)
+        return false;
+
+    const char *p = data + index_offset;
+    for (uint32_t i = 0; i < count; i++, p += ARCHIVE_ENTRY_SIZE)
+    {
+        ArchiveBlock block;
+        block.offset = get_u64(p);
+        block.size = get_u32(p + 8);
+        block.raw_size = get_u32(p + 12);
+        block.count = get_u32(p + 16);
+        block.batch = get_u32(p + 20);
+        block.first_id = get_u64(p + 24);
+        block.last_id = get_u64(p + 32);
+        block.checksum = get_u32(p + 40);
+        if (block.offset < ARCHIVE_HEADER_SIZE || block.offset + block.size > index_offset)
+            return false;
+        index.push_back(block);
+    }
+    return true;
+}
+
+bool Archive::read(size_t position, TaskStore &items) const
+{
+    const ArchiveBlock &block = index[position];
+    const char *data = file.data() + block.offset;
+    if ((uint32_t)fnv1a(data, block.size) != block.checksum)
+        return false;
+
+    string text;
+    if (!lz_decompress(data, block.size, block.raw_size, text))
+        return false;
+
+    // Parsed on this thread, with text going into its arena
+    size_t first = items.size();
+    int malformed = 0;
+    parse_csv_range(text.data(), text.data() + text.size(), text.data() + text.size(),
+                    false, items, malformed);
+    return malformed == 0 && items.size() - first == block.count;
+}
+
+bool Archive::append(const string &path, const TaskStore &items, const vector<uint32_t> &positions)
+{
+    string contents(ARCHIVE_MAGIC, 8);
+    put_u32(contents, ARCHIVE_VERSION);
+    put_u32(contents, 0);  // No flags defined yet
+
+    // Blocks written before stay as they are, only their place changes
+    vector<ArchiveBlock> blocks = index;
+    for (ArchiveBlock &block : blocks)
+    {
+        contents.append(file.data() + block.offset, block.size);
+        block.offset = contents.size() - block.size;
+    }
+
+    // IDs of the last batch, whose tasks may not have left the list
+    uint32_t batch = blocks.empty() ? 1 : blocks.back().batch + 1;
+    vector<uint64_t> recent;
+    {
+        TextArena arena;
+        TextArena *previous = thread_arena;
+        thread_arena = &arena;
+        TaskStore last;
+        bool intact = true;
+        for (size_t i = 0; i < index.size(); i++)
+            if (index[i].batch == batch - 1)
+                intact = intact && read(i, last);
+        thread_arena = previous;
+        if (!intact)
+            return false;
+
+        for (size_t i = 0; i < last.size(); i++)
+            recent.push_back(last.id(i));
+        sort(recent.begin(), recent.end());
+    }
+
+    // New tasks, a block at a time
+    uint64_t next_id = next_task;
+    ostringstream text;
+    size_t done = 0;
+    while (done < positions.size())
+    {
+        ArchiveBlock block;
+        block.batch = batch;
+        block.first_id = UINT64_MAX;
+        text.str("");
+        for (; done < positions.size() && block.count < ARCHIVE_BLOCK_TASKS; done++)
+        {
+            uint32_t position = positions[done];
+            uint64_t id = items.id(position);
+            if (binary_search(recent.begin(), recent.end(), id))
+                continue;
+
+            write_csv_task(text, items[position]);
+            block.count++;
+            block.first_id = min(block.first_id, id);
+            block.last_id = max(block.last_id, id);
+            next_id = max(next_id, id + 1);
+        }
+        if (block.count == 0)
+            continue;
+
+        string raw = text.str();
+        block.offset = contents.size();
+        block.raw_size = (uint32_t)raw.size();
+        lz_compress(raw.data(), raw.size(), contents);
+        block.size = (uint32_t)(contents.size() - block.offset);
+        block.checksum = (uint32_t)fnv1a(contents.data() + block.offset, block.size);
+        blocks.push_back(block);
+    }
+
+    // Index of all blocks and the trailer pointing to it
+    uint64_t index_offset = contents.size();
+    for (const ArchiveBlock &block : blocks)
+    {
+        put_u64(contents, block.offset);
+        put_u32(contents, block.size);
+        put_u32(contents, block.raw_size);
+        put_u32(contents, block.count);
+        put_u32(contents, block.batch);
+        put_u64(contents, block.first_id);
+        put_u64(contents, block.last_id);
+        put_u32(contents, block.checksum);
+    }
+    uint32_t checksum = (uint32_t)fnv1a(contents.data() + index_offset, contents.size() - index_offset);
+    put_u64(contents, index_offset);
+    put_u32(contents, (uint32_t)blocks.size());
+    put_u32(contents, checksum);
+    put_u64(contents, next_id);
+    contents.append(ARCHIVE_END_MAGIC, 8);
+
+    // Windows refuses to replace a file that is still mapped
+    file.close();
+    if (!replace_file(path.c_str(), contents))
+        return false;
+
+    index = blocks;
+    next_task = next_id;
+    return true;
+}
+
+uint64_t Archive::next_id(const string &path)
+{
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in || (size_t)in.tellg() < ARCHIVE_HEADER_SIZE + ARCHIVE_TRAILER_SIZE)
+        return 0;
+
+    char trailer[ARCHIVE_TRAILER_SIZE];
+    in.seekg(-(streamoff)ARCHIVE_TRAILER_SIZE, ios::end);
+    if (!in.read(trailer, ARCHIVE_TRAILER_SIZE) ||
+        memcmp(trailer + ARCHIVE_TRAILER_SIZE - 8, ARCHIVE_END_MAGIC, 8) != 0)
+        return 0;
+    return get_u64(trailer + 16);
+}
+
+int archive_tasks(int32_t before)
+{
+    ScopedTimer timer("archive");
+
+    // Completed tasks whose due date is long past
+    vector<uint32_t> positions;
+    for (size_t i = 0; i < todo_items.size(); i++)
+        if (!todo_items.is_removed(i) && todo_items.completed(i) &&
+            todo_items.due_date(i) != NO_DUE_DATE && todo_items.due_date(i) < before)
+            positions.push_back(i);
+    if (positions.empty())
+        return 0;
+
+    // Tasks only leave the list once they are safely in the archive
+    Archive archive;
+    if (!archive.open(archive_path) || !archive.append(archive_path, todo_items, positions))
+        return -1;
+
+    commit_bulk(CHANGE_REMOVE, positions);
+    return (int)positions.size();
+}
+
+bool print_archived(ostream &out, ostream &err, const ListView &view,
+                    const string *query, size_t first, size_t count)
+{
+    ScopedTimer timer("read archive");
+    Archive archive;
+    if (!archive.open(view.archive_path))
+    {
+        err << "Error: " << view.archive_path << " is damaged" << endl;
+        return false;
+    }
+
+    // Text of archived tasks only lives as long as the command
+    TextArena arena;
+    TextArena *previous = thread_arena;
+    thread_arena = &arena;
+
+    // Tasks still in the list are left out, which only happens to
+    // completed ones, since no others are archived
+    vector<uint64_t> completed;
+    if (query == nullptr && first > 0)
+    {
+        for (size_t i = 0; i < view.items.size(); i++)
+            if (!view.items.is_removed(i) && view.items.completed(i))
+                completed.push_back(view.items.id(i));
+        sort(completed.begin(), completed.end());
+    }
+
+    bool intact = true;
+    const vector<ArchiveBlock> &blocks = archive.blocks();
+    for (size_t i = 0; i < blocks.size() && count > 0 && intact; i++)
+    {
+        // Blocks before the first task are skipped without reading them,
+        // unless some of their tasks may be left out
+        auto in_list = lower_bound(completed.begin(), completed.end(), blocks[i].first_id);
+        if (query == nullptr && first >= blocks[i].count &&
+            (in_list == completed.end() || *in_list > blocks[i].last_id))
+        {
+            first -= blocks[i].count;
+            continue;
+        }
+
+        TaskStore items;
+        intact = archive.read(i, items);
+
+        // Tasks that are in the list as well are shown from there
+        vector<uint64_t> matches;
+        if (query != nullptr)
+        {
+            matches = SearchIndex::scan(items, *query);
+            sort(matches.begin(), matches.end());
+        }
+        for (size_t j = 0; j < items.size(); j++)
+            if (view.slots.find(items.id(j)) != TaskTable::npos ||
+                (query != nullptr && !binary_search(matches.begin(), matches.end(), items.id(j))))
+                items.remove(j);
+
+        size_t live = items.live_count();
+        print_tasks(out, items, first, count);
+        size_t printed = live > first ? min(live - first, count) : 0;
+        first -= min(first, live);
+        count -= printed;
+    }
+    thread_arena = previous;
+
+    if (!intact)
+        err << "Error: " << view.archive_path << " is damaged" << endl;
+    return intact;
+}
+
+bool run_command(const vector<string> &args, ostream &out, ostream &err)
+{
+    const string &name = args[0];
+    if (is_query(name))
+        return run_query(active_view(), args, out, err);
+
+    ScopedTimer timer(name);
+
+    // Mark and remove also work on many tasks, given other than by
+    // a single number
+    if ((name == "mark" || name == "remove") &&
+        (args.size() > 2 || (args.size() == 2 && args[1].find_first_of(",-") != string::npos)))
+        return run_bulk(args, out, err);
+
+    // Commands working on an existing task take its number first
+    size_t first_option = 1;
+    uint32_t position = 0;
+    if (name == "mark" || name == "edit" || name == "remove")
+    {
+        if (args.size() < 2 || !parse_task_number(args[1], position))
+        {
+            err << name << ": expected the number of an existing task" << endl;
+            return false;
+        }
+        first_option = 2;
+    }
+
+    // Commands after use work on another list
+    if (name == "use")
+    {
+        if (args.size() != 2 || !is_list_name(args[1]))
+        {
+            err << "use: expected a list name made of letters, digits, - and _" << endl;
+            return false;
+        }
+
+        if (!use_list(args[1]))
+        {
+            err << "use: cannot open list " << args[1] << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Lists that are loaded show their number of tasks
+    if (name == "lists")
+    {
+        if (args.size() > 1)
+        {
+            err << "lists: unexpected argument " << args[1] << endl;
+            return false;
+        }
+
+        for (const string &list : list_names())
+        {
+            auto parked = parked_lists.find(list);
+            out << (list == active_list ? "* " : "  ") << list;
+            if (list == active_list)
+                out << " (" << todo_items.live_count() << " task(s))";
+            else if (parked != parked_lists.end())
+                out << " (" << parked->second->items.live_count() << " task(s))";
+            out << '\n';
+        }
+        return true;
+    }
+
+    // Archive moves old completed tasks out of the list
+    if (name == "archive")
+    {
+        int32_t before = today() - ARCHIVE_AGE;
+        if (args.size() == 3 && args[1] == "--before")
+        {
+            before = pack_date(args[2]);
+            if (before == NO_DUE_DATE)
+            {
+                err << "archive: invalid date " << args[2] << endl;
+                return false;
+            }
+        }
+        else if (args.size() != 1)
+        {
+            err << "archive: expected no arguments or --before DATE" << endl;
+            return false;
+        }
+
+        int archived = archive_tasks(before);
+        if (archived < 0)
+        {
+            err << "Error: could not write " << archive_path << endl;
+            return false;
+        }
+        out << "Archived " << archived << " task(s)" << '\n';
+        return true;
+    }
+
+    // Only add and edit have options
+    if (first_option < args.size() && name != "add" && name != "edit")
+    {
+        err << name << ": unexpected argument " << args[first_option] << endl;
+        return false;
+    }
+
+    // Collect options of the form --name VALUE
+    const string *title = nullptr, *description = nullptr, *due_date = nullptr;
+    for (size_t i = first_option; i < args.size(); i += 2)
+    {
+        if (i + 1 == args.size())
+        {
+            err << name << ": missing value for " << args[i] << endl;
+            return false;
+        }
+
+        if (args[i] == "--title")
+            title = &args[i + 1];
+        else if (args[i] == "--desc")
+            description = &args[i + 1];
+        else if (args[i] == "--due")
+            due_date = &args[i + 1];
+        else
+        {
+            err << name << ": unknown option " << args[i] << endl;
+            return false;
+        }
+    }
+
+    // Dates are stored as a number of days
+    int32_t date = NO_DUE_DATE;
+    if (due_date != nullptr)
+    {
+        date = pack_date(*due_date);
+        if (date == NO_DUE_DATE)
+        {
+            err << name << ": invalid date " << *due_date << endl;
+            return false;
+        }
+    }
+
+    if (title != nullptr && title->empty())
+    {
+        err << name << ": title must not be empty" << endl;
+        return false;
+    }
+
+    Change change;
+
+    if (name == "add")
+    {
+        if (title == nullptr || due_date == nullptr)
+        {
+            err << "add: --title and --due are required" << endl;
+            return false;
+        }
+
+        change.type = CHANGE_ADD;
+        change.item.title = *title;
+        change.item.description = description != nullptr ? *description : string();
+        change.item.due_date = date;
+    }
+    else if (name == "mark")
+    {
+        // Marking a completed task again changes nothing
+        if (todo_items.completed(position))
+            return true;
+        change.type = CHANGE_MARK;
+        change.id = todo_items.id(position);
+    }
+    else if (name == "edit")
+    {
+        // Fields that are not given keep their value
+        change.type = CHANGE_EDIT;
+        change.id = todo_items.id(position);
+        change.item.title = title != nullptr ? Text(*title) : todo_items.title(position);
+        change.item.description = description != nullptr ? Text(*description) : todo_items.description(position);
+        change.item.due_date = due_date != nullptr ? date : todo_items.due_date(position);
+    }
+    else if (name == "remove")
+    {
+        change.type = CHANGE_REMOVE;
+        change.id = todo_items.id(position);
+    }
+    else
+    {
+        err << "Unknown command: " << name << endl;
+        return false;
+    }
+
+    commit_change(move(change));
+    return true;
+}
+
+bool run_bulk(const vector<string> &args, ostream &out, ostream &err)
+{
+    const string &name = args[0];
+    vector<pair<uint64_t, uint64_t>> ranges;
+    bool by_id = false, completed_only = false, by_due = false;
+    int32_t due_before = NO_DUE_DATE;
+
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (args[i] == "--completed")
+            completed_only = true;
+        else if (args[i] == "--due-before")
+        {
+            if (i + 1 == args.size())
+            {
+                err << name << ": missing value for " << args[i] << endl;
+                return false;
+            }
+            due_before = pack_date(args[++i]);
+            if (due_before == NO_DUE_DATE)
+            {
+                err << name << ": invalid date " << args[i] << endl;
+                return false;
+            }
+            by_due = true;
+        }
+        else if (!by_id && args[i].compare(0, 2, "--") != 0)
+        {
+            if (!parse_id_set(args[i], ranges))
+            {
+                err << name << ": invalid task numbers " << args[i] << endl;
+                return false;
+            }
+            by_id = true;
+        }
+        else
+        {
+            err << name << ": unexpected argument " << args[i] << endl;
+            return false;
+        }
+    }
+
+    // Select the tasks in a single scan, in the order of the list
+    vector<uint32_t> positions;
+    for (size_t i = 0; i < todo_items.size(); i++)
+    {
+        if (todo_items.is_removed(i))
+            continue;
+        if (completed_only && !todo_items.completed(i))
+            continue;
+        if (by_due && (todo_items.due_date(i) == NO_DUE_DATE || todo_items.due_date(i) >= due_before))
+            continue;
+        if (by_id)
+        {
+            // Last range starting at or before the ID
+            uint64_t id = todo_items.id(i);
+            auto range = upper_bound(ranges.begin(), ranges.end(), make_pair(id, UINT64_MAX));
+            if (range == ranges.begin() || prev(range)->second < id)
+                continue;
+        }
+        positions.push_back(i);
+    }
+
+    size_t changed = commit_bulk(name == "mark" ? CHANGE_MARK : CHANGE_REMOVE, positions);
+    out << (name == "mark" ? "Marked " : "Removed ") << changed << " task(s)" << '\n';
+    return true;
+}
+
+bool parse_id_set(const string &arg, vector<pair<uint64_t, uint64_t>> &ranges)
+{
+    ranges.clear();
+    const char *p = arg.data();
+    const char *end = p + arg.size();
+
+    while (true)
+    {
+        // Either a single ID or two separated by a dash
+        uint64_t first, last;
+        auto result = from_chars(p, end, first);
+        if (result.ec != errc())
+            return false;
+        p = result.ptr;
+        last = first;
+        if (p < end && *p == '-')
+        {
+            result = from_chars(p + 1, end, last);
+            if (result.ec != errc() || last < first)
+                return false;
+            p = result.ptr;
+        }
+        ranges.push_back({first, last});
+
+        if (p == end)
+            break;
+        if (*p++ != ',')
+            return false;
+    }
+
+    // Overlapping ranges are merged, so that each ID is in one at most
+    sort(ranges.begin(), ranges.end());
+    size_t count = 0;
+    for (const auto &range : ranges)
+    {
+        if (count > 0 && (ranges[count - 1].second == UINT64_MAX || range.first <= ranges[count - 1].second + 1))
+            ranges[count - 1].second = max(ranges[count - 1].second, range.second);
+        else
+            ranges[count++] = range;
+    }
+    ranges.resize(count);
+    return true;
+}
+
+bool is_query(const string &name)
+{
+    return name == "view" || name == "search" || name == "stats" ||
+           name == "overdue" || name == "week" || name == "next" ||
+           name == "history";
+}
+
+bool run_query(const ListView &view, const vector<string> &args, ostream &out, ostream &err)
+{
+    const string &name = args[0];
+    ScopedTimer timer(name);
+    size_t first_option = 1;
+
+    // Number of tasks to list can be given to next
+    size_t next_count = NEXT_COUNT;
+    if (name == "next" && args.size() >= 2)
+    {
+        if (!parse_number(args[1], next_count))
+        {
+            err << "next: expected a number of tasks" << endl;
+            return false;
+        }
+        first_option = 2;
+    }
+
+    // Search takes the words of the query, and looks
+    // in the archive as well if asked to
+    if (name == "search")
+    {
+        string query;
+        bool archived = false;
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            if (args[i] == "--archive")
+            {
+                archived = true;
+                continue;
+            }
+            query += args[i];
+            query += ' ';
+        }
+
+        if (query.empty())
+        {
+            err << "search: expected words to look for" << endl;
+            return false;
+        }
+
+        if (view.search == nullptr)
+            print_task_list(out, view.items, view.slots, SearchIndex::scan(view.items, query));
+        else
+        {
+            view.search->build(view.items);
+            print_task_list(out, view.items, view.slots, view.search->find(query));
+        }
+        return !archived || print_archived(out, err, view, &query, 0, SIZE_MAX);
+    }
+
+    // Only view and history have options
+    if (first_option < args.size() && name != "view" && name != "history")
+    {
+        err << name << ": unexpected argument " << args[first_option] << endl;
+        return false;
+    }
+
+    // Collect options of the form --name VALUE
+    const string *page = nullptr, *page_size = nullptr, *sort_keys = nullptr;
+    for (size_t i = first_option; i < args.size(); i += 2)
+    {
+        if (i + 1 == args.size())
+        {
+            err << name << ": missing value for " << args[i] << endl;
+            return false;
+        }
+
+        if (args[i] == "--page")
+            page = &args[i + 1];
+        else if (args[i] == "--page-size")
+            page_size = &args[i + 1];
+        else if (args[i] == "--sort")
+            sort_keys = &args[i + 1];
+        else
+        {
+            err << name << ": unknown option " << args[i] << endl;
+            return false;
+        }
+    }
+
+    if (name == "overdue" || name == "week" || name == "next")
+    {
+        // Day range the command looks at
+        int32_t from = today(), to = INT32_MAX;
+        if (name == "overdue")
+        {
+            to = from;
+            from = NO_DUE_DATE + 1;
+        }
+        else if (name == "week")
+            to = from + WEEK_DAYS;
+
+        // Scanning is quicker than building the index for a single
+        // lookup, but next needs only the first few tasks. Snapshots
+        // only have the index if the list had built it.
+        vector<uint64_t> ids;
+        if (!view.due.built() && (name != "next" || view.snapshot != nullptr))
+        {
+            ids = find_due(view.items, from, to);
+            if (name == "next" && ids.size() > next_count)
+                ids.resize(next_count);
+        }
+        else
+        {
+            view.due.build(view.items);
+            auto range = view.due.range(from, to);
+            for (auto entry = range.first; entry != range.second; ++entry)
+            {
+                if (name == "next" && ids.size() == next_count)
+                    break;
+                ids.push_back(entry->id);
+            }
+        }
+
+        print_task_list(out, view.items, view.slots, ids);
+        return true;
+    }
+    else if (name == "stats")
+    {
+        size_t total = view.items.live_count();
+        size_t completed = count_completed(view.items);
+        int32_t day = today();
+
+        out << "Tasks: " << total << '\n'
+            << "Completed: " << completed << '\n'
+            << "Incomplete: " << total - completed << '\n'
+            << "Overdue: " << count_due(view.items, NO_DUE_DATE + 1, day) << '\n'
+            << "Due this week: " << count_due(view.items, day, day + WEEK_DAYS) << '\n';
+        return true;
+    }
+
+    // Archived tasks keep the order they were archived in
+    if (name == "history" && sort_keys != nullptr)
+    {
+        err << "history: unknown option --sort" << endl;
+        return false;
+    }
+
+    vector<SortKey> keys;
+    if (sort_keys != nullptr && !parse_sort_keys(*sort_keys, keys))
+    {
+        err << "view: sort keys must be due, completed or title" << endl;
+        return false;
+    }
+
+    // Whole list, unless a page is asked for
+    size_t page_number = 1, tasks_per_page = SIZE_MAX;
+    if (page != nullptr || page_size != nullptr)
+        tasks_per_page = VIEW_PAGE_SIZE;
+    if ((page != nullptr && !parse_number(*page, page_number)) ||
+        (page_size != nullptr && !parse_number(*page_size, tasks_per_page)) ||
+        page_number == 0 || tasks_per_page == 0)
+    {
+        err << "view: page and page size must be positive numbers" << endl;
+        return false;
+    }
+
+    size_t first = tasks_per_page == SIZE_MAX ? 0 : (page_number - 1) * tasks_per_page;
+    if (name == "history")
+        return print_archived(out, err, view, nullptr, first, tasks_per_page);
+    if (keys.empty())
+    {
+        print_tasks(out, view.items, first, tasks_per_page);
+        return true;
+    }
+
+    // Tasks of the page in sorted order. Other readers of a
+    // snapshot may sort it by other keys in the meantime.
+    vector<uint64_t> ids;
+    {
+        unique_lock<mutex> lock;
+        if (view.snapshot != nullptr)
+            lock = unique_lock<mutex>(view.snapshot->sort_lock);
+
+        const vector<uint32_t> &order = sort_tasks(view, keys);
+        for (size_t i = first; i < order.size() && ids.size() < tasks_per_page; i++)
+            ids.push_back(view.items.id(order[i]));
+    }
+
+    print_task_list(out, view.items, view.slots, ids);
+    return true;
+}
+
+ListView active_view()
+{
+    return { todo_items, task_slots, due_index, &search_index,
+             sort_cache, todo_items_version, nullptr, archive_path };
+}
+
+shared_ptr<ListSnapshot> take_snapshot()
+{
+    ScopedTimer timer("take_snapshot");
+    auto snapshot = make_shared<ListSnapshot>();
+    snapshot->list = active_list;
+    snapshot->version = todo_items_version;
+
+    // Columns are copied as they are, removed tasks included, and
+    // text is shared, since it never changes once it is stored
+    snapshot->items = todo_items;
+    snapshot->slots = task_slots;
+    if (due_index.built())
+        snapshot->due = due_index;
+    text_arena.share(snapshot->text);
+    snapshot->file = save_file;
+    snapshot->archive_path = archive_path;
+    return snapshot;
+}
+
+bool refresh_snapshot(ListSnapshot &snapshot)
+{
+    if (!keep_change_log || snapshot.list != active_list || snapshot.file != save_file ||
+        snapshot.version < change_log_start || snapshot.version > todo_items_version)
+        return false;
+
+    // Changes up to the version of the snapshot are in it already
+    auto first = upper_bound(change_log.begin(), change_log.end(),
+                             make_pair(snapshot.version, UINT64_MAX));
+    size_t changed = change_log.end() - first;
+
+    // Removed tasks stay in the snapshot, so it is taken again once they
+    // pile up, and when so many tasks changed that copying is as quick
+    if (changed > snapshot.items.size() / 4 + TASK_COMPACT_MIN ||
+        snapshot.items.removed_count() > snapshot.items.size() / 2 + TASK_COMPACT_MIN)
+        return false;
+
+    ScopedTimer timer("refresh_snapshot");
+    for (auto entry = first; entry != change_log.end(); ++entry)
+    {
+        uint64_t id = entry->second;
+        uint32_t from = find_task(id);
+        uint32_t to = snapshot.slots.find(id);
+        if (to != TaskTable::npos)
+            snapshot.due.erase(snapshot.items[to]);
+
+        // Removed from the list since
+        if (from == TaskTable::npos)
+        {
+            if (to != TaskTable::npos)
+            {
+                snapshot.slots.erase(id);
+                snapshot.items.remove(to);
+            }
+            continue;
+        }
+
+        // Added tasks come in the order they were added to the list
+        TodoItem task = todo_items[from];
+        if (to == TaskTable::npos)
+        {
+            snapshot.slots.insert(id, snapshot.items.size());
+            snapshot.items.push_back(task);
+        }
+        else
+        {
+            snapshot.items.title(to) = task.title;
+            snapshot.items.description(to) = task.description;
+            snapshot.items.set_due_date(to, task.due_date);
+            snapshot.items.set_completed(to, task.completed);
+        }
+        snapshot.due.insert(task);
+    }
+
+    // Text of the changed tasks may live in chunks added since
+    text_arena.share(snapshot.text);
+    sort(snapshot.text.begin(), snapshot.text.end());
+    snapshot.text.erase(unique(snapshot.text.begin(), snapshot.text.end()), snapshot.text.end());
+
+    snapshot.version = todo_items_version;
+    return true;
+}
+
+void log_change(uint64_t id)
+{
+    if (!keep_change_log)
+        return;
+
+    // Snapshots that far behind are taken again anyway
+    if (change_log.size() > todo_items.size() / 4 + TASK_COMPACT_MIN)
+    {
+        change_log.clear();
+        change_log_start = todo_items_version;
+    }
+    change_log.push_back({todo_items_version, id});
+}
+
+void trim_change_log(uint64_t version)
+{
+    auto last = upper_bound(change_log.begin(), change_log.end(), make_pair(version, UINT64_MAX));
+    change_log.erase(change_log.begin(), last);
+    change_log_start = max(change_log_start, version);
+}
+
+int run_batch(istream &in)
+{
+    string line;
+    vector<string> args;
+    ostringstream errors;
+    int line_number = 0;
+    int failed = 0;
+
+    while (getline(in, line))
+    {
+        line_number++;
+
+        if (!split_command_line(line, args))
+        {
+            cerr << "Line " << line_number << ": unterminated quote" << endl;
+            failed++;
+            continue;
+        }
+
+        // Skip empty lines and comments
+        if (args.empty() || args[0][0] == '#')
+            continue;
+
+        // Errors are prefixed with the line they come from
+        bool succeeded = run_command(args, cout, errors);
+        if (!succeeded)
+        {
+            cerr << "Line " << line_number << ": " << errors.str();
+            failed++;
+        }
+
+        // Stream is reused for the next line, keeping its memory
+        if (errors.tellp() > 0)
+            errors.str(string());
+    }
+
+    return failed;
+}
+
+bool split_command_line(const string &line, vector<string> &args)
+{
+    // Strings of the previous line are reused, so that their
+    // memory does not have to be allocated again for every line
+    size_t count = 0;
+    auto next_arg = [&args, &count]() -> string & {
+        if (count == args.size())
+            args.emplace_back();
+        args[count].clear();
+        return args[count++];
+    };
+
+    string *arg = nullptr;  // Argument characters are collected in
+    bool quoted = false;    // Whether inside double quotes
+
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        char c = line[i];
+
+        if (c == '\\' && i + 1 < line.size())
+        {
+            if (arg == nullptr)
+                arg = &next_arg();
+            *arg += line[++i];
+        }
+        else if (c == '"')
+        {
+            quoted = !quoted;
+            if (arg == nullptr)
+                arg = &next_arg();
+        }
+        else if (!quoted && isspace((unsigned char)c))
+        {
+            // End of argument
+            arg = nullptr;
+        }
+        else
+        {
+            if (arg == nullptr)
+                arg = &next_arg();
+            *arg += c;
+        }
+    }
+
+    // Arguments left over from a longer line are dropped
+    args.resize(count);
+    return !quoted;
+}
+
+bool parse_number(const string &arg, size_t &number)
+{
+    // Only plain decimal numbers are accepted
+    if (arg.empty() || arg.size() > 9 || arg.find_first_not_of("0123456789") != string::npos)
+        return false;
+
+    number = stoul(arg);
+    return true;
+}
+
+bool parse_task_number(const string &arg, uint32_t &position)
+{
+    // Task numbers are IDs, which may take up all 64 bits
+    uint64_t id;
+    auto result = from_chars(arg.data(), arg.data() + arg.size(), id);
+    if (arg.empty() || result.ec != errc() || result.ptr != arg.data() + arg.size())
+        return false;
+
+    position = find_task(id);
+    return position != TaskTable::npos;
+}
+
+void DueIndex::build(const TaskStore &items)
+{
+    if (is_built)
+        return;
+
+    ScopedTimer timer("build due index");
+
+    entries.clear();
+    for (size_t i = 0; i < items.size(); i++)
+        if (!items.is_removed(i) && !items.completed(i) && items.due_date(i) != NO_DUE_DATE)
+            entries.push_back({items.due_date(i), items.id(i)});
+
+    sort(entries.begin(), entries.end());
+    is_built = true;
+}
+
+void DueIndex::insert(const TodoItem &task)
+{
+    // Only incomplete tasks with a due date are indexed
+    if (!is_built || task.completed || task.due_date == NO_DUE_DATE)
+        return;
+
+    DueEntry entry = {task.due_date, task.id};
+    entries.insert(lower_bound(entries.begin(), entries.end(), entry), entry);
+}
+
+void DueIndex::erase(const TodoItem &task)
+{
+    if (!is_built || task.completed || task.due_date == NO_DUE_DATE)
+        return;
+
+    DueEntry entry = {task.due_date, task.id};
+    auto found = lower_bound(entries.begin(), entries.end(), entry);
+    if (found != entries.end() && found->id == task.id)
+        entries.erase(found);
+}
+
+void DueIndex::adopt(vector<DueEntry> sorted)
+{
+    entries = move(sorted);
+    is_built = true;
+}
+
+void DueIndex::erase(const vector<uint64_t> &ids)
+{
+    if (!is_built || ids.empty())
+        return;
+
+    auto is_erased = [&ids](const DueEntry &entry) {
+        return binary_search(ids.begin(), ids.end(), entry.id);
+    };
+    entries.erase(remove_if(entries.begin(), entries.end(), is_erased), entries.end());
+}
+
+pair<vector<DueEntry>::const_iterator, vector<DueEntry>::const_iterator>
+DueIndex::range(int32_t from, int32_t to) const
+{
+    // Binary search for both ends of the range
+    auto first = lower_bound(entries.begin(), entries.end(), DueEntry{from, 0});
+    auto last = lower_bound(first, entries.end(), DueEntry{to, 0});
+    return {first, last};
+}
+
+void SearchIndex::build(const TaskStore &items)
+{
+    if (is_built)
+        return;
+
+    ScopedTimer timer("build search index");
+
+    postings.clear();
+    is_built = true;
+    for (size_t i = 0; i < items.size(); i++)
+        if (!items.is_removed(i))
+            insert(items[i]);
+}
+
+void SearchIndex::insert(const TodoItem &task)
+{
+    if (!is_built)
+        return;
+
+    vector<string> words;
+    collect_words(task, words);
+    for (const string &word : words)
+    {
+        // Tasks are mostly indexed in order of their IDs
+        vector<uint64_t> &list = postings[word];
+        if (list.empty() || list.back() < task.id)
+            list.push_back(task.id);
+        else
+            list.insert(lower_bound(list.begin(), list.end(), task.id), task.id);
+    }
+}
+
+void SearchIndex::erase(const TodoItem &task)
+{
+    if (!is_built)
+        return;
+
+    vector<string> words;
+    collect_words(task, words);
+    for (const string &word : words)
+    {
+        auto found = postings.find(word);
+        if (found == postings.end())
+            continue;
+
+        vector<uint64_t> &list = found->second;
+        auto entry = lower_bound(list.begin(), list.end(), task.id);
+        if (entry != list.end() && *entry == task.id)
+            list.erase(entry);
+
+        // Words no task contains any more are dropped
+        if (list.empty())
+            postings.erase(found);
+    }
+}
+
+void SearchIndex::erase(const vector<uint64_t> &ids)
+{
+    if (!is_built || ids.empty())
+        return;
+
+    auto is_erased = [&ids](uint64_t id) {
+        return binary_search(ids.begin(), ids.end(), id);
+    };
+    for (auto found = postings.begin(); found != postings.end();)
+    {
+        vector<uint64_t> &list = found->second;
+        list.erase(remove_if(list.begin(), list.end(), is_erased), list.end());
+
+        // Words no task contains any more are dropped
+        if (list.empty())
+            found = postings.erase(found);
+        else
+            ++found;
+    }
+}
+
+vector<uint64_t> SearchIndex::find(string_view query) const
+{
+    vector<string> terms;
+    split_words(query, terms);
+
+    vector<uint64_t> result;
+    for (size_t i = 0; i < terms.size(); i++)
+    {
+        // Tasks containing any word that starts with the term
+        vector<uint64_t> matches;
+        size_t lists = 0;
+        for (auto word = postings.lower_bound(terms[i]);
+             word != postings.end() && word->first.compare(0, terms[i].size(), terms[i]) == 0;
+             ++word, ++lists)
+            matches.insert(matches.end(), word->second.begin(), word->second.end());
+
+        if (lists > 1)
+        {
+            sort(matches.begin(), matches.end());
+            matches.erase(unique(matches.begin(), matches.end()), matches.end());
+        }
+
+        // Tasks have to match every term
+        if (i == 0)
+            result.swap(matches);
+        else
+        {
+            vector<uint64_t> both;
+            set_intersection(result.begin(), result.end(),
+                             matches.begin(), matches.end(), back_inserter(both));
+            result.swap(both);
+        }
+
+        if (result.empty())
+            break;
+    }
+
+    return result;
+}
+
+vector<uint64_t> SearchIndex::scan(const TaskStore &items, string_view query)
+{
+    vector<string> terms;
+    split_words(query, terms);
+
+    // Lower case of every byte that belongs to words, 0 for the others
+    static const array<unsigned char, 256> word_bytes = [] {
+        array<unsigned char, 256> bytes = {};
+        for (int c = 1; c < 256; c++)
+            if (isalnum(c) || c >= 0x80)
+                bytes[c] = (unsigned char)tolower(c);
+        return bytes;
+    }();
+
+    vector<uint64_t> result;
+    vector<bool> found(terms.size());
+    for (size_t i = 0; i < items.size() && !terms.empty(); i++)
+    {
+        if (items.is_removed(i))
+            continue;
+
+        // Terms that start a word of the title or description,
+        // words being split the same way as for the index
+        size_t missing = terms.size();
+        found.assign(terms.size(), false);
+        for (string_view text : { items.title(i).view(), items.description(i).view() })
+        {
+            for (size_t start = 0; start < text.size() && missing > 0; )
+            {
+                if (word_bytes[(unsigned char)text[start]] == 0)
+                {
+                    start++;
+                    continue;
+                }
+
+                size_t end = start;
+                while (end < text.size() && word_bytes[(unsigned char)text[end]] != 0)
+                    end++;
+
+                for (size_t t = 0; t < terms.size(); t++)
+                {
+                    const string &term = terms[t];
+                    if (found[t] || term.size() > end - start)
+                        continue;
+
+                    size_t k = 0;
+                    while (k < term.size() && word_bytes[(unsigned char)text[start + k]] == (unsigned char)term[k])
+                        k++;
+                    if (k == term.size())
+                    {
+                        found[t] = true;
+                        missing--;
+                    }
+                }
+                start = end;
+            }
+        }
+
+        if (missing == 0)
+            result.push_back(items.id(i));
+    }
+
+    sort(result.begin(), result.end());
+    return result;
+}
+
+void SearchIndex::collect_words(const TodoItem &task, vector<string> &words)
+{
+    split_words(task.title.view(), words);
+    split_words(task.description.view(), words);
+
+    sort(words.begin(), words.end());
+    words.erase(unique(words.begin(), words.end()), words.end());
+}
+
+void SearchIndex::split_words(string_view text, vector<string> &words)
+{
+    string word;
+    for (size_t i = 0; i <= text.size(); i++)
+    {
+        // Bytes outside ASCII belong to words, so UTF-8 text is kept whole
+        unsigned char c = i < text.size() ? text[i] : ' ';
+        if (isalnum(c) || c >= 0x80)
+            word += (char)tolower(c);
+        else if (!word.empty())
+        {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+}
+
+void TaskTable::clear()
+{
+    entries.clear();
+    count = 0;
+}
+
+void TaskTable::reserve(size_t size)
+{
+    // Keep the table at most half full
+    size_t capacity = 16;
+    while (capacity < size * 2)
+        capacity *= 2;
+    if (capacity <= entries.size())
+        return;
+
+    vector<Entry> old(capacity);
+    old.swap(entries);
+    for (const Entry &entry : old)
+    {
+        if (entry.id == NO_TASK_ID)
+            continue;
+        size_t i = home(entry.id);
+        while (entries[i].id != NO_TASK_ID)
+            i = (i + 1) & (entries.size() - 1);
+        entries[i] = entry;
+    }
+}
+
+uint32_t TaskTable::find(uint64_t id) const
+{
+    if (entries.empty() || id == NO_TASK_ID)
+        return npos;
+
+    for (size_t i = home(id); entries[i].id != NO_TASK_ID; i = (i + 1) & (entries.size() - 1))
+        if (entries[i].id == id)
+            return entries[i].index;
+    return npos;
+}
+
+bool TaskTable::insert(uint64_t id, uint32_t index)
+{
+    reserve(count + 1);
+
+    size_t i = home(id);
+    for (; entries[i].id != NO_TASK_ID; i = (i + 1) & (entries.size() - 1))
+        if (entries[i].id == id)
+            return false;
+
+    entries[i].id = id;
+    entries[i].index = index;
+    count++;
+    return true;
+}
+
+void TaskTable::erase(uint64_t id)
+{
+    if (entries.empty())
+        return;
+
+    size_t mask = entries.size() - 1;
+    size_t i = home(id);
+    while (entries[i].id != id)
+    {
+        if (entries[i].id == NO_TASK_ID)
+            return;
+        i = (i + 1) & mask;
+    }
+
+    // Move later entries of the probe sequence into the gap,
+    // unless that would place them before their home entry
+    for (size_t next = (i + 1) & mask; entries[next].id != NO_TASK_ID; next = (next + 1) & mask)
+    {
+        size_t wanted = home(entries[next].id);
+        if (((next - wanted) & mask) >= ((next - i) & mask))
+        {
+            entries[i] = entries[next];
+            i = next;
+        }
+    }
+
+    entries[i] = Entry();
+    count--;
+}
+
+size_t TaskTable::home(uint64_t id) const
+{
+    // Mix the bits, since IDs are mostly consecutive numbers
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    return id & (entries.size() - 1);
+}
+
+void index_tasks()
+{
+    ScopedTimer timer("index_tasks");
+    task_slots.clear();
+    task_slots.reserve(todo_items.size());
+
+    for (size_t i = 0; i < todo_items.size(); i++)
+        if (todo_items.id(i) >= next_task_id)
+            next_task_id = todo_items.id(i) + 1;
+
+    // IDs of archived tasks are not given out again
+    next_task_id = max(next_task_id, Archive::next_id(archive_path));
+
+    for (size_t i = 0; i < todo_items.size(); i++)
+    {
+        if (todo_items.id(i) == NO_TASK_ID || !task_slots.insert(todo_items.id(i), i))
+        {
+            todo_items.set_id(i, next_task_id++);
+            task_slots.insert(todo_items.id(i), i);
+
+            // A due index loaded with the tasks knows the old ID
+            due_index.clear();
+        }
+    }
+}
+
+uint32_t find_task(uint64_t id)
+{
+    return task_slots.find(id);
+}
+
+void reclaim_text()
+{
+    // Count the text that is still in use
+    size_t in_use = 0;
+    for (size_t i = 0; i < todo_items.size(); i++)
+    {
+        if (!todo_items.title(i).borrows())
+            in_use += todo_items.title(i).view().size();
+        if (!todo_items.description(i).borrows())
+            in_use += todo_items.description(i).view().size();
+    }
+
+    if (text_arena.used() <= 2 * in_use + TEXT_CHUNK_SIZE)
+        return;
+
+    TextArena arena;
+    for (size_t i = 0; i < todo_items.size(); i++)
+    {
+        todo_items.title(i).relocate(arena);
+        todo_items.description(i).relocate(arena);
+    }
+    text_arena.swap(arena);
+}
+
+void compact_tasks()
+{
+    if (todo_items.removed_count() == 0)
+        return;
+
+    todo_items.compact();
+    todo_items_version = ++version_clock;
+
+    task_slots.clear();
+    task_slots.reserve(todo_items.size());
+    for (size_t i = 0; i < todo_items.size(); i++)
+        task_slots.insert(todo_items.id(i), i);
+}
+
+void TaskStore::reserve(size_t count)
+{
+    ids.reserve(count);
+    titles.reserve(count);
+    descriptions.reserve(count);
+    due_dates.reserve(count);
+    completed_bits.reserve((count + 63) / 64);
+}
+
+void TaskStore::resize(size_t count)
+{
+    // Only growing is supported, which keeps unused bits clear
+    if (count <= ids.size())
+        return;
+
+    ids.resize(count, NO_TASK_ID);
+    titles.resize(count);
+    descriptions.resize(count);
+    due_dates.resize(count, NO_DUE_DATE);
+    completed_bits.resize((count + 63) / 64, 0);
+}
+
+void TaskStore::push_back(const TodoItem &task)
+{
+    size_t index = ids.size();
+    resize(index + 1);
+    ids[index] = task.id;
+    titles[index] = task.title;
+    descriptions[index] = task.description;
+    due_dates[index] = task.due_date;
+    set_completed(index, task.completed);
+}
+
+void TaskStore::append(const TaskStore &other)
+{
+    size_t first = ids.size();
+    ids.insert(ids.end(), other.ids.begin(), other.ids.end());
+    titles.insert(titles.end(), other.titles.begin(), other.titles.end());
+    descriptions.insert(descriptions.end(), other.descriptions.begin(), other.descriptions.end());
+    due_dates.insert(due_dates.end(), other.due_dates.begin(), other.due_dates.end());
+    completed_bits.resize((ids.size() + 63) / 64, 0);
+    removed += other.removed;
+
+    // Bits only line up word by word if this store ends on a word
+    if (first % 64 == 0)
+        copy(other.completed_bits.begin(), other.completed_bits.end(),
+             completed_bits.begin() + first / 64);
+    else
+        for (size_t i = 0; i < other.size(); i++)
+            set_completed(first + i, other.completed(i));
+}
+
+TodoItem TaskStore::operator[](size_t index) const
+{
+    TodoItem task;
+    task.title = titles[index];
+    task.description = descriptions[index];
+    task.due_date = due_dates[index];
+    task.completed = completed(index);
+    task.id = ids[index];
+    return task;
+}
+
+void TaskStore::set_completed(size_t index, bool value)
+{
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    if (value)
+        completed_bits[index / 64] |= bit;
+    else
+        completed_bits[index / 64] &= ~bit;
+}
+
+void TaskStore::remove(size_t index)
+{
+    if (ids[index] == NO_TASK_ID)
+        return;
+
+    ids[index] = NO_TASK_ID;
+    titles[index] = Text();
+    descriptions[index] = Text();
+    due_dates[index] = NO_DUE_DATE;
+    set_completed(index, false);
+    removed++;
+}
+
+void TaskStore::compact()
+{
+    // Move remaining tasks forward, column by column
+    size_t count = 0;
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        if (ids[i] == NO_TASK_ID)
+            continue;
+        if (count != i)
+        {
+            ids[count] = ids[i];
+            titles[count] = titles[i];
+            descriptions[count] = descriptions[i];
+            due_dates[count] = due_dates[i];
+            set_completed(count, completed(i));
+        }
+        count++;
+    }
+
+    ids.resize(count);
+    titles.resize(count);
+    descriptions.resize(count);
+    due_dates.resize(count);
+    completed_bits.resize((count + 63) / 64);
+
+    // Bits past the last task have to stay clear
+    if (count % 64 != 0)
+        completed_bits.back() &= ((uint64_t)1 << (count % 64)) - 1;
+    removed = 0;
+}
+
+uint64_t due_range_mask_scalar(const int32_t *dates, int32_t from, int32_t to)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i++)
+        mask |= (uint64_t)(dates[i] >= from && dates[i] < to) << i;
+    return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+uint64_t due_range_mask_avx2(const int32_t *dates, int32_t from, int32_t to)
+{
+    // Only greater-than comparisons exist, so the range
+    // is tested as from - 1 < date < to
+    __m256i low = _mm256_set1_epi32(from - 1);
+    __m256i high = _mm256_set1_epi32(to);
+
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i += 8)
+    {
+        __m256i date = _mm256_loadu_si256((const __m256i *)(dates + i));
+        __m256i match = _mm256_and_si256(_mm256_cmpgt_epi32(date, low),
+                                         _mm256_cmpgt_epi32(high, date));
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(match)) << i;
+    }
+    return mask;
+}
+#elif defined(__aarch64__)
+uint64_t due_range_mask_neon(const int32_t *dates, int32_t from, int32_t to)
+{
+    int32x4_t low = vdupq_n_s32(from);
+    int32x4_t high = vdupq_n_s32(to);
+
+    // Weight of each lane in the resulting mask
+    static const uint32_t weights[4] = {1, 2, 4, 8};
+    uint32x4_t weight = vld1q_u32(weights);
+
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i += 4)
+    {
+        int32x4_t date = vld1q_s32(dates + i);
+        uint32x4_t match = vandq_u32(vcgeq_s32(date, low), vcltq_s32(date, high));
+        mask |= (uint64_t)vaddvq_u32(vandq_u32(match, weight)) << i;
+    }
+    return mask;
+}
+#endif
+
+DueRangeKernel select_due_range_kernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+        return due_range_mask_avx2;
+#elif defined(__aarch64__)
+    // Every 64-bit ARM processor has NEON
+    return due_range_mask_neon;
+#endif
+    return due_range_mask_scalar;
+}
+
+uint64_t select_due(const TaskStore &items, size_t block, int32_t from, int32_t to)
+{
+    static const DueRangeKernel kernel = select_due_range_kernel();
+
+    // Tasks without a due date are never due
+    from = max(from, NO_DUE_DATE + 1);
+    if (from >= to)
+        return 0;
+
+    const int32_t *dates = items.due_date_column() + block * 64;
+    size_t count = min((size_t)64, items.size() - block * 64);
+
+    // Last block is padded, so that the kernel can read all 64 dates
+    int32_t padded[64];
+    if (count < 64)
+    {
+        copy(dates, dates + count, padded);
+        fill(padded + count, padded + 64, NO_DUE_DATE);
+        dates = padded;
+    }
+
+    return kernel(dates, from, to) & ~items.completed_column()[block];
+}
+
+size_t count_due(const TaskStore &items, int32_t from, int32_t to)
+{
+    size_t count = 0;
+    for (size_t block = 0; block < items.block_count(); block++)
+        count += __builtin_popcountll(select_due(items, block, from, to));
+    return count;
+}
+
+vector<uint64_t> find_due(const TaskStore &items, int32_t from, int32_t to)
+{
+    vector<DueEntry> entries;
+    for (size_t block = 0; block < items.block_count(); block++)
+    {
+        // Turn each set bit of the mask into the index of its task
+        for (uint64_t mask = select_due(items, block, from, to); mask != 0; mask &= mask - 1)
+        {
+            size_t i = block * 64 + __builtin_ctzll(mask);
+            entries.push_back({items.due_date(i), items.id(i)});
+        }
+    }
+
+    // Same order as the due date index
+    sort(entries.begin(), entries.end());
+
+    vector<uint64_t> ids;
+    ids.reserve(entries.size());
+    for (const DueEntry &entry : entries)
+        ids.push_back(entry.id);
+    return ids;
+}
+
+size_t count_completed(const TaskStore &items)
+{
+    // Bits of removed tasks and past the last task are clear
+    size_t count = 0;
+    for (size_t block = 0; block < items.block_count(); block++)
+        count += __builtin_popcountll(items.completed_column()[block]);
+    return count;
+}
+
+bool TaskOrder::operator()(uint32_t a, uint32_t b) const
+{
+    for (SortKey key : keys)
+    {
+        switch (key)
+        {
+            case SORT_DUE:
+            {
+                // Tasks without a due date come last
+                uint32_t due_a = (uint32_t)items->due_date(a) - (uint32_t)NO_DUE_DATE - 1;
+                uint32_t due_b = (uint32_t)items->due_date(b) - (uint32_t)NO_DUE_DATE - 1;
+                if (due_a != due_b)
+                    return due_a < due_b;
+                break;
+            }
+            case SORT_COMPLETED:
+                if (items->completed(a) != items->completed(b))
+                    return items->completed(b);
+                break;
+            case SORT_TITLE:
+            {
+                string_view title_a = items->title(a).view();
+                string_view title_b = items->title(b).view();
+                size_t length = min(title_a.size(), title_b.size());
+                for (size_t i = 0; i < length; i++)
+                {
+                    int c_a = tolower((unsigned char)title_a[i]);
+                    int c_b = tolower((unsigned char)title_b[i]);
+                    if (c_a != c_b)
+                        return c_a < c_b;
+                }
+                if (title_a.size() != title_b.size())
+                    return title_a.size() < title_b.size();
+                break;
+            }
+        }
+    }
+
+    return items->id(a) < items->id(b);
+}
+
+bool parse_sort_keys(const string &arg, vector<SortKey> &keys)
+{
+    keys.clear();
+
+    size_t start = 0;
+    while (true)
+    {
+        size_t comma = arg.find(',', start);
+        string key = arg.substr(start, comma == string::npos ? string::npos : comma - start);
+
+        if (key == "due")
+            keys.push_back(SORT_DUE);
+        else if (key == "completed")
+            keys.push_back(SORT_COMPLETED);
+        else if (key == "title")
+            keys.push_back(SORT_TITLE);
+        else
+            return false;
+
+        if (comma == string::npos)
+            return true;
+        start = comma + 1;
+    }
+}
+
+const vector<uint32_t> &sort_tasks(const ListView &view, const vector<SortKey> &keys)
+{
+    if (view.sorted.version == view.version && view.sorted.keys == keys)
+        return view.sorted.order;
+
+    ScopedTimer timer("sort_tasks");
+
+    TaskOrder order = {&view.items, keys};
+    vector<uint32_t> &result = view.sorted.order;
+    result.clear();
+
+    // The due date index already orders incomplete tasks by due date
+    // and ID, which is all that matters when the other keys only
+    // tell incomplete tasks from completed ones
+    size_t other_keys = 0;
+    for (SortKey key : keys)
+        other_keys += key != SORT_COMPLETED;
+    bool by_due_only = other_keys == 1 && count(keys.begin(), keys.end(), SORT_DUE) == 1;
+
+    if (by_due_only && view.due.built())
+    {
+        // Indexed tasks first, in order
+        vector<uint32_t> indexed;
+        auto range = view.due.range(NO_DUE_DATE + 1, INT32_MAX);
+        for (auto entry = range.first; entry != range.second; ++entry)
+            indexed.push_back(view.slots.find(entry->id));
+
+        // Everything else has to be sorted
+        vector<uint32_t> rest;
+        for (size_t i = 0; i < view.items.size(); i++)
+            if (!view.items.is_removed(i) &&
+                (view.items.completed(i) || view.items.due_date(i) == NO_DUE_DATE))
+                rest.push_back(i);
+        parallel_sort(rest, order);
+
+        result.resize(indexed.size() + rest.size());
+        merge(indexed.begin(), indexed.end(), rest.begin(), rest.end(), result.begin(), order);
+    }
+    else
+    {
+        result.reserve(view.items.live_count());
+        for (size_t i = 0; i < view.items.size(); i++)
+            if (!view.items.is_removed(i))
+                result.push_back(i);
+        parallel_sort(result, order);
+    }
+
+    view.sorted.keys = keys;
+    view.sorted.version = view.version;
+    return result;
+}
+
+template <class Compare>
+void parallel_sort(vector<uint32_t> &values, Compare less)
+{
+    size_t threads = min((size_t)thread::hardware_concurrency(), values.size() / SORT_THREAD_MIN_SIZE);
+    if (threads <= 1)
+    {
+        sort(values.begin(), values.end(), less);
+        return;
+    }
+
+    // Boundaries of the slices
+    vector<size_t> bounds(threads + 1);
+    for (size_t i = 0; i <= threads; i++)
+        bounds[i] = values.size() / threads * i;
+    bounds[threads] = values.size();
+
+    vector<thread> workers;
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back([&, i] {
+            sort(values.begin() + bounds[i], values.begin() + bounds[i + 1], less);
+        });
+    for (thread &worker : workers)
+        worker.join();
+
+    // Merge neighbouring runs until a single one is left
+    vector<uint32_t> buffer(values.size());
+    for (size_t width = 1; width < threads; width *= 2)
+    {
+        workers.clear();
+        for (size_t i = 0; i < threads; i += 2 * width)
+        {
+            size_t low = bounds[i];
+            size_t middle = bounds[min(i + width, threads)];
+            size_t high = bounds[min(i + 2 * width, threads)];
+            workers.emplace_back([&, low, middle, high] {
+                merge(values.begin() + low, values.begin() + middle,
+                      values.begin() + middle, values.begin() + high,
+                      buffer.begin() + low, less);
+            });
+        }
+        for (thread &worker : workers)
+            worker.join();
+        values.swap(buffer);
+    }
+}
+
+bool is_list_name(const string &name)
+{
+    if (name.empty())
+        return false;
+
+    for (char c : name)
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_')
+            return false;
+    return true;
+}
+
+string list_data_path(const string &name)
+{
+    if (name == DEFAULT_LIST)
+        return DATA_PATH;
+    return LIST_DIRECTORY "/" + name + ".csv";
+}
+
+bool create_list_directory(const string &name)
+{
+    if (name == DEFAULT_LIST)
+        return true;
+
+#ifdef __MINGW32__
+    int status = _mkdir(LIST_DIRECTORY);
+#else
+    int status = mkdir(LIST_DIRECTORY, 0755);
+#endif
+    if (status == -1 && errno != EEXIST)
+    {
+        cerr << "Error: could not create " << LIST_DIRECTORY << endl;
+        return false;
+    }
+    return true;
+}
+
+bool use_list(const string &name)
+{
+    if (name == active_list)
+        return true;
+
+    ScopedTimer timer("use_list");
+
+    unique_ptr<TodoList> &slot = parked_lists[name];
+    bool loaded = slot != nullptr;
+
+    if (!loaded && !create_list_directory(name))
+    {
+        parked_lists.erase(name);
+        return false;
+    }
+
+    // Changes of the active list have to be in its journal
+    // before it is put aside
+    flush_changes();
+    FsyncPolicy policy = journal.policy;
+
+    if (!loaded)
+        slot = make_unique<TodoList>();
+
+    // The list put aside takes the place of the one made active
+    string previous = active_list;
+    unique_ptr<TodoList> list = move(slot);
+    parked_lists.erase(name);
+    swap_active_list(*list);
+    list->last_used = ++list_clock;
+    parked_lists[active_list] = move(list);
+    active_list = name;
+
+    // Lists are read when they are first used
+    if (!loaded)
+    {
+        data_path = list_data_path(name);
+        journal_path = data_path + JOURNAL_SUFFIX;
+        archive_path = data_path + ARCHIVE_SUFFIX;
+        journal.policy = policy;
+
+        todo_items = retrieve_data();
+
+        // The list that was active stays so, and the damaged file is
+        // left alone. Other clients of a server keep being served.
+        if (save_file_damaged)
+        {
+            save_file_damaged = false;
+            unique_ptr<TodoList> restored = move(parked_lists[previous]);
+            parked_lists.erase(previous);
+            swap_active_list(*restored);
+            active_list = previous;
+            return false;
+        }
+
+        index_tasks();
+        open_journal();
+        todo_items_version = ++version_clock;
+        change_log.clear();
+        change_log_start = todo_items_version;
+    }
+
+    trim_lists();
+    return true;
+}
+
+void swap_active_list(TodoList &list)
+{
+    swap(todo_items, list.items);
+    text_arena.swap(list.arena);
+    swap(todo_items_dirty, list.dirty);
+    swap(task_slots, list.slots);
+    swap(next_task_id, list.next_id);
+    swap(due_index, list.due);
+    swap(search_index, list.search);
+    swap(todo_items_version, list.version);
+    swap(sort_cache, list.sorted);
+    save_file.swap(list.file);
+    swap(save_format, list.format);
+    swap(save_file_hash, list.file_hash);
+    swap(save_file_size, list.file_size);
+    swap(save_layout, list.layout);
+    journal.swap(list.journal);
+    data_path.swap(list.data_path);
+    journal_path.swap(list.journal_path);
+    archive_path.swap(list.archive_path);
+    change_log.swap(list.changes);
+    swap(change_log_start, list.changes_start);
+}
+
+size_t list_memory(const TaskStore &items, const TextArena &arena, size_t file_size)
+{
+    // Columns and the task table entry of every task, text
+    // in the arena and the mapped save file
+    size_t per_task = sizeof(uint64_t) * 3 + sizeof(Text) * 2 + sizeof(int32_t);
+    return items.size() * per_task + arena.used() + file_size;
+}
+
+void trim_lists()
+{
+    size_t total = list_memory(todo_items, text_arena, save_file_size);
+    for (const auto &entry : parked_lists)
+        total += list_memory(entry.second->items, entry.second->arena, entry.second->file_size);
+
+    while (total > list_memory_budget && !parked_lists.empty())
+    {
+        auto oldest = parked_lists.begin();
+        for (auto it = parked_lists.begin(); it != parked_lists.end(); ++it)
+            if (it->second->last_used < oldest->second->last_used)
+                oldest = it;
+
+        // All changes are in the journal, which is closed along
+        // with the list and replayed when it is loaded again
+        const TodoList &list = *oldest->second;
+        total -= list_memory(list.items, list.arena, list.file_size);
+        parked_lists.erase(oldest);
+    }
+}
+
+void close_lists()
+{
+    parked_lists.clear();
+}
+
+vector<string> list_names()
+{
+    vector<string> names = { DEFAULT_LIST, active_list };
+    for (const auto &entry : parked_lists)
+        names.push_back(entry.first);
+
+    // Every save file or journal in the list directory
+    // belongs to a list, whether it was loaded or not
+    string suffix = ".csv", journal_suffix = JOURNAL_SUFFIX;
+#ifdef __MINGW32__
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA(LIST_DIRECTORY "\\*", &found);
+    if (search != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            string file = found.cFileName;
+#else
+    DIR *directory = opendir(LIST_DIRECTORY);
+    if (directory != nullptr)
+    {
+        while (dirent *found = readdir(directory))
+        {
+            string file = found->d_name;
+#endif
+            if (file.size() > journal_suffix.size() &&
+                file.compare(file.size() - journal_suffix.size(), journal_suffix.size(), journal_suffix) == 0)
+                file.resize(file.size() - journal_suffix.size());
+
+            if (file.size() > suffix.size() &&
+                file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0)
+            {
+                string name = file.substr(0, file.size() - suffix.size());
+                if (is_list_name(name))
+                    names.push_back(name);
+            }
+#ifdef __MINGW32__
+        } while (FindNextFileA(search, &found));
+        FindClose(search);
+    }
+#else
+        }
+        closedir(directory);
+    }
+#endif
+
+    sort(names.begin(), names.end());
+    names.erase(unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+void write_json_string(string &out, string_view value)
+{
+    out += '"';
+    for (char c : value)
+    {
+        switch (c)
+        {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                // Other control characters have no short escape
+                if ((unsigned char)c < 0x20)
+                {
+                    char escape[8];
+                    snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    out += escape;
+                }
+                else
+                    out += c;
+        }
+    }
+    out += '"';
+}
+
+bool scan_json_string(const char *&p, const char *end, string &scratch, string_view &value)
+{
+    if (p == end || *p != '"')
+        return false;
+    const char *start = ++p;
+
+    // Fast path for strings without escapes, which are used in place
+    while (p != end && *p != '"' && *p != '\\')
+    {
+        if ((unsigned char)*p < 0x20)
+            return false;
+        p++;
+    }
+    if (p == end)
+        return false;
+    if (*p == '"')
+    {
+        value = string_view(start, p++ - start);
+        return true;
+    }
+
+    scratch.assign(start, p - start);
+    while (p != end && *p != '"')
+    {
+        char c = *p++;
+        if ((unsigned char)c < 0x20)
+            return false;
+        if (c != '\\')
+        {
+            scratch += c;
+            continue;
+        }
+
+        if (p == end)
+            return false;
+        switch (c = *p++)
+        {
+            case '"': case '\\': case '/': scratch += c; break;
+            case 'b': scratch += '\b'; break;
+            case 'f': scratch += '\f'; break;
+            case 'n': scratch += '\n'; break;
+            case 'r': scratch += '\r'; break;
+            case 't': scratch += '\t'; break;
+            case 'u':
+            {
+                auto read_hex = [&p, end](uint32_t &code) {
+                    if (end - p < 4 || from_chars(p, p + 4, code, 16).ptr != p + 4)
+                        return false;
+                    p += 4;
+                    return true;
+                };
+
+                uint32_t code, low;
+                if (!read_hex(code) || (code >= 0xDC00 && code < 0xE000))
+                    return false;
+
+                // Characters outside the basic plane come as surrogate pairs
+                if (code >= 0xD800 && code < 0xDC00)
+                {
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                        return false;
+                    p += 2;
+                    if (!read_hex(low) || low < 0xDC00 || low >= 0xE000)
+                        return false;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+
+                // Encode as UTF-8
+                if (code < 0x80)
+                    scratch += (char)code;
+                else if (code < 0x800)
+                {
+                    scratch += (char)(0xC0 | code >> 6);
+                    scratch += (char)(0x80 | (code & 0x3F));
+                }
+                else if (code < 0x10000)
+                {
+                    scratch += (char)(0xE0 | code >> 12);
+                    scratch += (char)(0x80 | (code >> 6 & 0x3F));
+                    scratch += (char)(0x80 | (code & 0x3F));
+                }
+                else
+                {
+                    scratch += (char)(0xF0 | code >> 18);
+                    scratch += (char)(0x80 | (code >> 12 & 0x3F));
+                    scratch += (char)(0x80 | (code >> 6 & 0x3F));
+                    scratch += (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    if (p == end)
+        return false;
+
+    p++;
+    value = scratch;
+    return true;
+}
+
+bool skip_json_literal(const char *&p, const char *end, const char *literal)
+{
+    size_t size = strlen(literal);
+    if ((size_t)(end - p) < size || memcmp(p, literal, size) != 0)
+        return false;
+    p += size;
+    return true;
+}
+
+bool parse_json_task(const char *p, const char *end, TodoItem &task, string *unescaped)
+{
+    auto skip_space = [&p, end] {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+    };
+    auto skip_literal = [&p, end](const char *literal) {
+        return skip_json_literal(p, end, literal);
+    };
+
+    task = TodoItem();
+    bool seen[TASK_FIELD_COUNT] = {};
+
+    skip_space();
+    if (p == end || *p++ != '{')
+        return false;
+    skip_space();
+    if (p != end && *p == '}')
+        return false;
+
+    while (true)
+    {
+        // Keys and unknown values share the last string
+        string &scratch = unescaped[TASK_FIELD_COUNT];
+        string_view key, value;
+        skip_space();
+        if (!scan_json_string(p, end, scratch, key))
+            return false;
+        skip_space();
+        if (p == end || *p++ != ':')
+            return false;
+        skip_space();
+        if (p == end)
+            return false;
+
+        // Fields of the schema, read by their codecs
+        bool valid = true;
+        bool known = find_field([&](const auto &field, auto index) {
+            if (key != field.name)
+                return false;
+            valid = codec_of<decltype(field)>::read_json(p, end, field.of(task), unescaped[index]);
+            seen[index] = true;
+            return true;
+        });
+
+        if (known)
+        {
+            if (!valid)
+                return false;
+        }
+        else if (*p == '"')
+        {
+            // Unknown fields are skipped, as long as they are not nested
+            if (!scan_json_string(p, end, scratch, value))
+                return false;
+        }
+        else if (!skip_literal("true") && !skip_literal("false") && !skip_literal("null"))
+        {
+            const char *start = p;
+            while (p != end && strchr("+-.0123456789eE", *p) != nullptr)
+                p++;
+            if (p == start)
+                return false;
+        }
+
+        skip_space();
+        if (p == end)
+            return false;
+        if (*p == '}')
+            break;
+        if (*p++ != ',')
+            return false;
+    }
+
+    // Nothing may follow the object
+    p++;
+    skip_space();
+    bool complete = true;
+    for_each_field([&](const auto &field, auto index) {
+        complete = complete && (seen[index] || !field.required);
+    });
+    return p == end && complete;
+}
+
+TaskReader::TaskReader(istream &in, StreamFormat format) : in(in), format(format)
+{
+    if (format == STREAM_CSV)
+        csv = make_unique<CsvReader>(in);
+}
+
+bool TaskReader::next(TodoItem &task)
+{
+    switch (format)
+    {
+        case STREAM_CSV:
+            return next_csv(task);
+        case STREAM_JSONL:
+            return next_jsonl(task);
+        default:
+            return next_snapshot(task);
+    }
+}
+
+bool TaskReader::next_csv(TodoItem &task)
+{
+    CsvRecord record;
+    while (true)
+    {
+        CsvStatus status = csv->next(record);
+        if (status == CSV_END)
+            return false;
+
+        // Escaped text is unescaped into the reader, not the text arena
+        if (status == CSV_RECORD && record_to_item(record, task, true, text))
+            return true;
+        skipped++;
+    }
+}
+
+bool TaskReader::next_jsonl(TodoItem &task)
+{
+    while (getline(in, line))
+    {
+        // Skip blank lines
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+
+        if (parse_json_task(line.data(), line.data() + line.size(), task, text))
+            return true;
+        skipped++;
+    }
+    return false;
+}
+
+bool TaskReader::next_snapshot(TodoItem &task)
+{
+    while (position == tasks.size())
+        if (finished || is_damaged || !read_block())
+            return false;
+
+    task = tasks[position++];
+    return true;
+}
+
+const char *TaskReader::BlockSource::take(size_t size)
+{
+    reader.columns.resize(size);
+    return reader.read_bytes(reader.columns.data(), size) ? reader.columns.data() : nullptr;
+}
+
+bool TaskReader::BlockSource::text(size_t size, Text &value)
+{
+    // Read in pieces so that a damaged length
+    // cannot claim a huge amount of memory
+    string &piece = reader.piece;
+    piece.clear();
+    for (size_t left = size; left > 0;)
+    {
+        size_t part = min(left, (size_t)CSV_BLOCK_SIZE);
+        size_t filled = piece.size();
+        piece.resize(filled + part);
+        if (!reader.read_bytes(&piece[filled], part))
+            return false;
+        left -= part;
+    }
+
+    value = Text::borrow(reader.arena.store(piece));
+    return true;
+}
+
+bool TaskReader::read_bytes(void *data, size_t size)
+{
+    in.read((char *)data, size);
+    if ((size_t)in.gcount() != size)
+    {
+        is_damaged = true;
+        return false;
+    }
+
+    hash = fnv1a((const char *)data, size, hash);
+    return true;
+}
+
+bool TaskReader::read_block()
+{
+    char bytes[8];
+
+    // Header, which tells the layout of the blocks
+    if (!started)
+    {
+        started = true;
+        hash = fnv1a(nullptr, 0);
+
+        char header[SNAPSHOT_HEADER_SIZE];
+        if (!read_bytes(header, SNAPSHOT_V1_HEADER_SIZE))
+            return false;
+        version = get_u32(header + 8);
+        if (!is_snapshot(header, SNAPSHOT_V1_HEADER_SIZE) || version > SNAPSHOT_VERSION)
+        {
+            is_damaged = true;
+            return false;
+        }
+
+        size_t header_size = version >= 3 ? SNAPSHOT_HEADER_SIZE
+                             : version >= 2 ? SNAPSHOT_V2_HEADER_SIZE : SNAPSHOT_V1_HEADER_SIZE;
+        if (!read_bytes(header + SNAPSHOT_V1_HEADER_SIZE, header_size - SNAPSHOT_V1_HEADER_SIZE))
+            return false;
+        has_total = !(get_u32(header + 12) & SNAPSHOT_FLAG_STREAMED);
+        total = get_u64(header + 16);
+
+        // Tables are only needed to find blocks without reading the
+        // ones before them, but the indexes they list are skipped
+        if (version >= 3)
+        {
+            char entry[SNAPSHOT_INDEX_ENTRY_SIZE];
+            for (uint32_t i = 0; i < get_u32(header + 32); i++)
+                if (!read_bytes(entry, SNAPSHOT_BLOCK_ENTRY_SIZE))
+                    return false;
+            for (uint32_t i = 0; i < get_u32(header + 36); i++)
+            {
+                if (!read_bytes(entry, SNAPSHOT_INDEX_ENTRY_SIZE))
+                    return false;
+                trailing += get_u64(entry + 16);
+            }
+            if (!read_bytes(bytes, 8))
+                return false;
+        }
+    }
+
+    tasks = TaskStore();
+    TextArena().swap(arena);
+    position = 0;
+
+    if (!read_bytes(bytes, 4))
+        return false;
+    uint32_t count = get_u32(bytes);
+
+    // End of blocks, followed by the checksum of everything before it
+    if (count == 0)
+    {
+        finished = true;
+        for (; trailing > 0; trailing -= min(trailing, (uint64_t)sizeof(bytes)))
+            if (!read_bytes(bytes, min(trailing, (uint64_t)sizeof(bytes))))
+                return false;
+
+        uint64_t checksum = hash;
+        if (!read_bytes(bytes, 8))
+            return false;
+        if (get_u64(bytes) != checksum || (has_total && seen != total))
+            is_damaged = true;
+        return false;
+    }
+
+    // Blocks are never larger, anything else is garbage
+    if (count > SNAPSHOT_BLOCK_SIZE)
+    {
+        is_damaged = true;
+        return false;
+    }
+
+    // Text is read into the arena, numbers into `columns`
+    BlockSource source = { *this };
+    tasks.resize(count);
+    if (!get_snapshot_block(source, version, 0, count, tasks))
+        return false;
+
+    seen += count;
+    return true;
+}
+
+TaskWriter::TaskWriter(ostream &out, StreamFormat format, uint64_t count, uint64_t next_id)
+    : out(out), format(format), count(count)
+{
+    if (format != STREAM_SNAPSHOT)
+        return;
+
+    // Same header as serialise_snapshot() writes, unless the number
+    // of tasks is not known in advance, with empty tables since
+    // the offsets of blocks are not known either
+    bool streamed = count == UINT64_MAX;
+    string header(SNAPSHOT_MAGIC, 8);
+    put_u32(header, SNAPSHOT_VERSION);
+    put_u32(header, streamed ? SNAPSHOT_FLAG_STREAMED : 0);
+    put_u64(header, streamed ? 0 : count);
+    put_u64(header, streamed ? 0 : next_id);
+    put_u32(header, 0);
+    put_u32(header, 0);
+    put_u64(header, 0);
+    put_u64(header, fnv1a(header.data(), header.size()));
+
+    hash = fnv1a(nullptr, 0);
+    emit(header);
+}
+
+void TaskWriter::write(const TodoItem &task)
+{
+    written++;
+
+    switch (format)
+    {
+        case STREAM_CSV:
+            write_csv_task(out, task);
+            break;
+
+        case STREAM_JSONL:
+        {
+            // Fields without a value, such as missing IDs, are left out
+            char separator = '{';
+            for_each_field([&](const auto &field, auto) {
+                using Codec = codec_of<decltype(field)>;
+                if (Codec::is_unset(field.of(task)))
+                    return;
+                buffer += separator;
+                buffer += '"';
+                buffer += field.name;
+                buffer += "\":";
+                Codec::write_json(buffer, field.of(task));
+                separator = ',';
+            });
+            buffer += "}\n";
+
+            // Lines are written in groups
+            if (buffer.size() >= CSV_BLOCK_SIZE)
+            {
+                out.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+            break;
+        }
+
+        case STREAM_SNAPSHOT:
+        {
+            // Text is kept until the block is written
+            block.push_back(task);
+            for_each_field([&](const auto &field, auto) {
+                if constexpr (codec_of<decltype(field)>::section == SECTION_TEXT)
+                    field.of(block.back()) = Text::borrow(arena.store(field.of(task).view()));
+            });
+            if (block.size() == SNAPSHOT_BLOCK_SIZE)
+                write_block();
+            break;
+        }
+    }
+}
+
+void TaskWriter::write_block()
+{
+    if (block.empty())
+        return;
+
+    string bytes;
+    put_snapshot_block(bytes, block, 0, block.size());
+    emit(bytes);
+
+    block.clear();
+    TextArena().swap(arena);
+}
+
+void TaskWriter::emit(const string &bytes)
+{
+    hash = fnv1a(bytes.data(), bytes.size(), hash);
+    out.write(bytes.data(), bytes.size());
+}
+
+bool TaskWriter::finish()
+{
+    if (format == STREAM_JSONL)
+    {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+    else if (format == STREAM_SNAPSHOT)
+    {
+        // Last block, the end of blocks and the checksum
+        write_block();
+        string end;
+        put_u32(end, 0);
+        emit(end);
+
+        string trailer;
+        put_u64(trailer, hash);
+        out.write(trailer.data(), trailer.size());
+    }
+
+    // A snapshot with the wrong task count in its header cannot be read
+    out.flush();
+    return !out.fail() && (count == UINT64_MAX || written == count);
+}
+
+void Profile::enable(bool trace)
+{
+    is_enabled = true;
+    keeps_trace = trace;
+    started = chrono::steady_clock::now();
+}
+
+void Profile::record(string_view name, chrono::steady_clock::time_point start,
+                     chrono::steady_clock::time_point stop)
+{
+    if (!is_enabled)
+        return;
+
+    uint64_t duration = chrono::duration_cast<chrono::nanoseconds>(stop - start).count();
+    lock_guard<mutex> guard(lock);
+
+    auto found = operations.find(name);
+    if (found == operations.end())
+        found = operations.emplace(string(name), OperationTimes()).first;
+    found->second.durations.push_back(duration);
+    found->second.total += duration;
+
+    // Long batches would otherwise fill memory with events
+    if (keeps_trace && events.size() < TRACE_EVENT_LIMIT)
+    {
+        uint64_t offset = chrono::duration_cast<chrono::nanoseconds>(start - started).count();
+        events.push_back({found->first, offset, duration});
+    }
+}
+
+void Profile::print(ostream &out) const
+{
+    // Nanoseconds as milliseconds with three decimals
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+
+    out << left << setw(24) << "Operation" << right
+        << setw(10) << "Runs" << setw(12) << "Total ms"
+        << setw(12) << "p50 ms" << setw(12) << "p99 ms"
+        << setw(12) << "Max ms" << endl;
+    out << fixed << setprecision(3);
+
+    for (const auto &[name, times] : operations)
+    {
+        // Nearest-rank percentiles of the sorted durations
+        vector<uint64_t> sorted = times.durations;
+        sort(sorted.begin(), sorted.end());
+        size_t n = sorted.size();
+        uint64_t p50 = sorted[(n * 50 + 99) / 100 - 1];
+        uint64_t p99 = sorted[(n * 99 + 99) / 100 - 1];
+
+        out << left << setw(24) << name << right
+            << setw(10) << n << setw(12) << ms(times.total)
+            << setw(12) << ms(p50) << setw(12) << ms(p99)
+            << setw(12) << ms(sorted.back()) << endl;
+    }
+
+    out << endl
+        << "Rows parsed:   " << rows_parsed << endl
+        << "Bytes read:    " << bytes_read << endl
+        << "Bytes written: " << bytes_written << endl
+        << "Allocations:   " << allocation_count.load(memory_order_relaxed)
+        << " (" << setprecision(1)
+        << allocated_bytes.load(memory_order_relaxed) / (1024.0 * 1024.0)
+        << " MB)" << endl;
+    out.unsetf(ios::floatfield);
+    out << setprecision(6);
+}
+
+bool Profile::write_trace(const char *path) const
+{
+    string contents = "{\"traceEvents\":[";
+    char number[32];
+
+    // Complete events, with times in microseconds
+    for (const TraceEvent &event : events)
+    {
+        contents += "{\"name\":";
+        write_json_string(contents, event.name);
+        snprintf(number, sizeof(number), "%.3f", event.start / 1e3);
+        contents += ",\"ph\":\"X\",\"ts\":";
+        contents += number;
+        snprintf(number, sizeof(number), "%.3f", event.duration / 1e3);
+        contents += ",\"dur\":";
+        contents += number;
+        contents += ",\"pid\":1,\"tid\":1},";
+    }
+
+    // Counters at the end of the run
+    uint64_t now = chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now() - started).count();
+    contents += "{\"name\":\"counters\",\"ph\":\"C\",\"ts\":" + to_string(now) +
+                ",\"pid\":1,\"tid\":1,\"args\":{" +
+                "\"rows_parsed\":" + to_string(rows_parsed) +
+                ",\"bytes_read\":" + to_string(bytes_read) +
+                ",\"bytes_written\":" + to_string(bytes_written) +
+                ",\"allocations\":" + to_string(allocation_count.load(memory_order_relaxed)) +
+                "}}],\"displayTimeUnit\":\"ms\"}\n";
+
+    return write_file(path, contents);
+}
+
+ScopedTimer::ScopedTimer(string_view name)
+    : name(name), running(profile.enabled())
+{
+    if (running)
+        start = chrono::steady_clock::now();
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    if (running)
+        profile.record(name, start, chrono::steady_clock::now());
+}
+
+void report_profile()
+{
+    if (print_stats)
+        profile.print(cerr);
+
+    if (trace_path != nullptr && !profile.write_trace(trace_path))
+        cerr << "Error: could not write " << trace_path << endl;
+}
+
+void encode_request(string &out, const vector<string> &args)
+{
+    size_t start = out.size();
+    put_u32(out, 0);
+    put_u32(out, (uint32_t)args.size());
+    for (const string &arg : args)
+    {
+        put_u32(out, (uint32_t)arg.size());
+        out += arg;
+    }
+
+    // Size of everything after the size itself
+    string size;
+    put_u32(size, (uint32_t)(out.size() - start - 4));
+    out.replace(start, 4, size);
+}
+
+size_t decode_request(const char *data, size_t size, vector<string> &args)
+{
+    if (size < 4)
+        return 0;
+
+    uint32_t length = get_u32(data);
+    if (length > SOCKET_REQUEST_LIMIT || length < 4)
+        return SIZE_MAX;
+    if (size - 4 < length)
+        return 0;
+
+    const char *p = data + 4, *end = p + length;
+    uint32_t count = get_u32(p);
+    p += 4;
+
+    // Every argument takes up at least its length
+    if (count == 0 || count > (size_t)(end - p) / 4)
+        return SIZE_MAX;
+
+    args.resize(count);
+    for (string &arg : args)
+    {
+        if (end - p < 4)
+            return SIZE_MAX;
+        uint32_t arg_size = get_u32(p);
+        p += 4;
+        if ((size_t)(end - p) < arg_size)
+            return SIZE_MAX;
+        arg.assign(p, arg_size);
+        p += arg_size;
+    }
+
+    return p == end ? length + 4 : SIZE_MAX;
+}
+
+void append_response(string &out, bool succeeded, const string &output, const string &errors)
+{
+    out += succeeded ? '\0' : '\1';
+    put_u32(out, (uint32_t)output.size());
+    put_u32(out, (uint32_t)errors.size());
+    out += output;
+    out += errors;
+}
+
+#ifdef __linux__
+
+// Answer to a request, which may still be worked on by a reader
+struct Response {
+    bool ready = false;
+    string bytes;
+};
+
+// Client of the server and the requests it sent, not answered yet
+struct Connection {
+    int fd;
+    string list;        // List the client's commands run on
+    string input;       // Received bytes not making up a whole request yet
+    deque<Response> responses;  // In the order the requests came in
+    size_t queries = 0;         // Responses a reader is working on
+    string output;      // Responses not sent yet
+    size_t sent = 0;    // Bytes of output already sent
+    bool closed = false;    // Whether the client sent everything it will
+    uint32_t events = EPOLLIN | EPOLLRDHUP;     // Events waited for
+};
+
+// Query handed to a reader thread, along with the snapshot it reads.
+// Holding the snapshot keeps it alive until the query is answered,
+// however many newer ones were taken in the meantime.
+struct Query {
+    Connection *connection;
+    Response *response;
+    shared_ptr<ListSnapshot> snapshot;
+    vector<string> args;
+    string bytes;       // Answer, filled in by the reader
+};
+
+// Threads answering queries while the event loop goes on with other
+// requests. Answered queries are handed back to the loop, which is
+// woken through an eventfd.
+class QueryPool {
+public:
+    explicit QueryPool(size_t threads);
+
+    // Lets the readers finish the queries they hold and stops them
+    ~QueryPool();
+
+    // Whether the readers could be started
+    bool started() const { return wake_fd != -1 && !threads.empty(); }
+
+    // Descriptor that becomes readable when queries were answered
+    int fd() const { return wake_fd; }
+
+    // Queues a query for the next free reader
+    void submit(unique_ptr<Query> query);
+
+    // Takes the queries answered since the last call
+    void collect(vector<unique_ptr<Query>> &answered);
+
+private:
+    void run();
 
-    // Add new task to todo_items vector
-    todo_items.push_back(task);
+    mutex lock;
+    condition_variable queued;
+    deque<unique_ptr<Query>> waiting;
+    vector<unique_ptr<Query>> done;
+    bool stopping = false;
+    int wake_fd;
+    vector<thread> threads;
+};
 
-    cout << "Task added successfully" << endl;
+QueryPool::QueryPool(size_t count) : wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    if (wake_fd == -1)
+        return;
+    for (size_t i = 0; i < count; i++)
+        threads.emplace_back(&QueryPool::run, this);
 }
 
-void view()
+QueryPool::~QueryPool()
 {
-    // Set counter
-    // Will be printed onto screen beside the task titles
-    int count = 1;
-
-    // Print title of output
-    cout << "All Tasks" << endl;
-
-    // Iterate over all items in todo_items vector
-    // and print their details onto screen
-    for (const auto &item : todo_items)
     {
-        cout << endl;
-        printf("%-3d", count++);
-        cout << "Title: " << item.title << endl;
-        cout << "   Desc: " << item.description << endl;
-        cout << "   Due Date: " << item.due_date << endl;
-        cout << "   Completed: " << (item.completed ? "Yes" : "No") << endl;
+        lock_guard<mutex> guard(lock);
+        stopping = true;
     }
+    queued.notify_all();
+    for (thread &reader : threads)
+        reader.join();
+    if (wake_fd != -1)
+        ::close(wake_fd);
 }
 
-void mark()
+void QueryPool::submit(unique_ptr<Query> query)
 {
-    // Prompt user for position of task in todo_item
-    // vector to be marked
-    int item_position = get_item_position("mark");
-
-    // Status code for operation abortion
-    if (item_position == -1)
-        return;
-
-    // Check if item is already marked before
-    if (todo_items[item_position].completed)
-        cout << "Task is already marked as completed." << endl;
-    else
     {
-        // Change the state of .completed attribute
-        todo_items[item_position].completed = true;
-        cout << "Task marked as completed." << endl;
+        lock_guard<mutex> guard(lock);
+        waiting.push_back(move(query));
     }
+    queued.notify_one();
 }
 
-void edit()
+void QueryPool::collect(vector<unique_ptr<Query>> &answered)
 {
-    // Prompt user for position of task in todo_item
-    // vector to be edited
-    int item_position = get_item_position("edit");
-
-    // Status code for operation abortion
-    if (item_position == -1)
-        return;
-        
-    // Get selected task from todo_items vector
-    auto task = todo_items[item_position];
-    
-    cout << "Enter task details (Empty to abort operation): " << endl;
+    // Resets the eventfd, every answer is taken below
+    uint64_t wakeups;
+    if (::read(wake_fd, &wakeups, sizeof(wakeups)) == -1 && errno != EAGAIN)
+        cerr << "Error: could not read the wakeups of the readers" << endl;
 
-    // Print initial title of task for user reference
-    cout << "Title " << "(was " << task.title <<  "): ";
-    getline(cin, task.title);
+    lock_guard<mutex> guard(lock);
+    for (unique_ptr<Query> &query : done)
+        answered.push_back(move(query));
+    done.clear();
+}
 
-    // Allow user to back out of operation if they no longer 
-    // wish to continue
-    if (task.title.empty())
+void QueryPool::run()
+{
+    ostringstream out, err;
+    while (true)
     {
-        cout << "Abort task." << endl;
-        return;
-    }
-
-    // Get updated decsription for selected task
-    cout << "Description: " << "(was " << task.description << "): ";
-    getline(cin, task.description);
+        unique_ptr<Query> query;
+        {
+            unique_lock<mutex> guard(lock);
+            queued.wait(guard, [this] { return stopping || !waiting.empty(); });
+            if (waiting.empty())
+                return;
+            query = move(waiting.front());
+            waiting.pop_front();
+        }
 
-    // Get updated due date for selected task
-    cout << "Due Date (DD/MM/YYYY, was " << task.due_date << "): ";
+        // Streams are reused for the next query, keeping their memory
+        out.str(string());
+        err.str(string());
 
-    // Get and validate date input
-    task.due_date = get_date_input();
+        ListSnapshot &snapshot = *query->snapshot;
+        ListView view = { snapshot.items, snapshot.slots, snapshot.due, nullptr,
+                          snapshot.sorted, snapshot.version, &snapshot, snapshot.archive_path };
+        bool succeeded = run_query(view, query->args, out, err);
+        append_response(query->bytes, succeeded, out.str(), err.str());
 
-    // Replace original task details with updated task details
-    todo_items[item_position] = task;
+        {
+            lock_guard<mutex> guard(lock);
+            done.push_back(move(query));
+        }
+        uint64_t wakeup = 1;
+        if (::write(wake_fd, &wakeup, sizeof(wakeup)) == -1 && errno != EAGAIN)
+            cerr << "Error: could not wake the server" << endl;
+    }
+}
 
-    cout << "Task edited successfully" << endl;
+void request_stop(int)
+{
+    stop_requested = 1;
 }
 
-void remove()
+// Sends as much of the output as the socket takes without blocking
+bool send_output(Connection &connection)
 {
-    // Prompt user for position of task in todo_item
-    // vector to be removed
-    int item_position = get_item_position("remove");
+    while (connection.sent < connection.output.size())
+    {
+        auto result = send(connection.fd, connection.output.data() + connection.sent,
+                           connection.output.size() - connection.sent, MSG_NOSIGNAL);
+        if (result == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        connection.sent += result;
+    }
 
-    // Status code for operation abortion
-    if (item_position == -1)
-        return;
+    connection.output.clear();
+    connection.sent = 0;
+    return true;
+}
 
-    // Character to hold user's decision ([y]es or [n]o)
-    char choice;
+bool serve(const char *path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        cerr << "Error: socket path " << path << " is too long" << endl;
+        return false;
+    }
+    strcpy(address.sun_path, path);
 
-    // Prompts user to enter choice
-    cout << "Confirm to delete \"" << todo_items[item_position].title << "\"? [y/n]: ";
-    cin >> choice;
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener == -1)
+    {
+        cerr << "Error: could not create a socket" << endl;
+        return false;
+    }
 
-    // Consider both lower and upper case inputs
-    // Proceed as long as the choice starts with
-    // the 'y' character
-    if (choice == 'y' || choice == 'Y')
+    // A socket that still accepts connections belongs to a running
+    // server, any other is left behind and can be replaced
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool running = probe != -1 && connect(probe, (sockaddr *)&address, sizeof(address)) == 0;
+    if (probe != -1)
+        ::close(probe);
+    if (running)
     {
-        // Delete the selected task from todo_items vector
-        todo_items.erase(todo_items.begin() + item_position);
-        cout << "Task deleted successfully." << endl;
+        cerr << "Error: a server is already listening on " << path << endl;
+        ::close(listener);
+        return false;
     }
-    // Confirmation failed
-    else
+    unlink(path);
+
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(listener, SOMAXCONN) == -1)
     {
-        cout << "Delete operation cancelled." << endl;
+        cerr << "Error: could not listen on " << path << endl;
+        ::close(listener);
+        return false;
     }
 
-    // Clear buffer for next input to prevent input issues
-    // (Ignore leftover input from this point)
-    cin.ignore(INT_MAX, '\n');
-}
+    // Events of the listener carry no pointer, those of the
+    // readers point to the pool, all others to their connection
+    QueryPool pool(SOCKET_READER_COUNT);
+    int events_fd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    bool waiting = events_fd != -1 && pool.started() &&
+                   epoll_ctl(events_fd, EPOLL_CTL_ADD, listener, &event) == 0;
+    event.data.ptr = &pool;
+    if (!waiting || epoll_ctl(events_fd, EPOLL_CTL_ADD, pool.fd(), &event) == -1)
+    {
+        cerr << "Error: could not wait for connections" << endl;
+        if (events_fd != -1)
+            ::close(events_fd);
+        ::close(listener);
+        unlink(path);
+        return false;
+    }
 
-int get_item_position(string action)
-{
-    // Hold user input for task position in todo_items vector
-    int input_num;
+    // Signals stop the server between requests. Without SA_RESTART,
+    // they interrupt the wait for events.
+    struct sigaction action = {};
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
 
-    while (true)
-    {
-        // Print customised prompt
-        cout << "Enter task number to " << action << " (0 to abort operation): ";
+    cerr << "Serving " << active_list << " on " << path << endl;
 
-        cin >> input_num;
-        // Clear buffer to prevent input issues
-        cin.ignore(INT_MAX, '\n');
+    // Nodes of a map keep their address, so events can point to them
+    map<int, Connection> connections;
+    vector<Connection *> answered;
+    vector<unique_ptr<Query>> answered_queries;
+    vector<int> finished;
+    string start_list = active_list;
+    epoll_event events[SOCKET_EVENT_COUNT];
+    vector<string> args;
+    ostringstream out, err;
+    char buffer[64 * 1024];
 
-        // If read successfully
-        if (cin)
+    // Latest snapshot of each list, taken when a query needs one, and
+    // the one before it, which catches up once its queries are done
+    map<string, shared_ptr<ListSnapshot>> snapshots;
+    map<string, shared_ptr<ListSnapshot>> spares;
+    keep_change_log = true;
+
+    while (!stop_requested)
+    {
+        // Batched fsyncs are due even while no client sends anything
+        int timeout = journal.policy == FSYNC_BATCH ? JOURNAL_SYNC_INTERVAL : -1;
+        int count = epoll_wait(events_fd, events, SOCKET_EVENT_COUNT, timeout);
+        if (count == -1 && errno != EINTR)
         {
-            // User chose to abort operation
-            if (input_num == 0)
+            cerr << "Error: could not wait for requests" << endl;
+            break;
+        }
+        if (count <= 0)
+        {
+            if (!journal.sync())
+                cerr << "Error: could not write " << journal_path << endl;
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            // New clients
+            if (events[i].data.ptr == nullptr)
             {
-                cout << "Abort task." << endl;
+                int fd;
+                while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+                {
+                    Connection &connection = connections[fd];
+                    connection.fd = fd;
+                    connection.list = start_list;
 
-                // Return status code for operation abortion
-                return -1;
+                    epoll_event added = {};
+                    added.events = connection.events;
+                    added.data.ptr = &connection;
+                    if (epoll_ctl(events_fd, EPOLL_CTL_ADD, fd, &added) == -1)
+                    {
+                        ::close(fd);
+                        connections.erase(fd);
+                    }
+                }
+                continue;
             }
 
-            // Input number is in valid range
-            if (input_num >= 1 && input_num <= todo_items.size())
-                break; // Move on to next step
-    
-            cout << "Task number is out of range." << endl;
+            // Answers of the readers
+            if (events[i].data.ptr == &pool)
+            {
+                pool.collect(answered_queries);
+                for (unique_ptr<Query> &query : answered_queries)
+                {
+                    query->response->bytes = move(query->bytes);
+                    query->response->ready = true;
+                    query->connection->queries--;
+                    answered.push_back(query->connection);
+                }
+                answered_queries.clear();
+                continue;
+            }
 
-            // Continue prompting for input
-            continue;
-        }
-        // User entered non-numeric values
-        else 
-        {
-            // Clear error flag of cin
-            // to enable next input
-            cin.clear();
+            Connection &connection = *(Connection *)events[i].data.ptr;
+            if (events[i].events & EPOLLOUT)
+                answered.push_back(&connection);
+            if (!(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                continue;
 
-            // Clear buffer
-            cin.ignore(INT_MAX, '\n');
+            // Everything sent so far
+            while (true)
+            {
+                auto received = recv(connection.fd, buffer, sizeof(buffer), 0);
+                if (received > 0)
+                    connection.input.append(buffer, received);
+                else if (received == -1 && errno == EINTR)
+                    continue;
+                else
+                {
+                    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                        connection.closed = true;
+                    break;
+                }
+            }
 
-            // Inform user about incorrect input
-            cout << "What you've entered is not a number." << endl;
+            // Whole requests, in the order they were sent
+            size_t used = 0;
+            while (true)
+            {
+                size_t size = decode_request(connection.input.data() + used,
+                                             connection.input.size() - used, args);
+                if (size == 0)
+                    break;
+                if (size == SIZE_MAX)
+                {
+                    // Nothing the client sends after this can be understood
+                    connection.closed = true;
+                    break;
+                }
+                used += size;
 
-            // Continue prompting for input
-            continue;
+                // Streams are reused for the next request, keeping their memory
+                out.str(string());
+                err.str(string());
+
+                // Lists of other clients may have been made active since
+                bool succeeded = false;
+                if (connection.list != active_list && !use_list(connection.list))
+                    err << "Cannot use list " << connection.list << endl;
+                else if (args[0] == "batch" || args[0] == "serve")
+                    err << args[0] << ": cannot be run on a server" << endl;
+                else if (is_query(args[0]))
+                {
+                    // Readers work on a snapshot of the list as it is now,
+                    // so that changes of later requests do not hold them up
+                    shared_ptr<ListSnapshot> &snapshot = snapshots[active_list];
+                    if (snapshot == nullptr || snapshot->version != todo_items_version)
+                    {
+                        // Only this loop holds a spare nobody reads any more
+                        shared_ptr<ListSnapshot> &spare = spares[active_list];
+                        if (spare != nullptr && spare.use_count() == 1 && refresh_snapshot(*spare))
+                            swap(snapshot, spare);
+                        else
+                        {
+                            spare = move(snapshot);
+                            snapshot = take_snapshot();
+                        }
+                        trim_change_log(spare != nullptr ? min(spare->version, snapshot->version)
+                                                         : snapshot->version);
+                    }
+
+                    connection.responses.emplace_back();
+                    connection.queries++;
+
+                    auto query = make_unique<Query>();
+                    query->connection = &connection;
+                    query->response = &connection.responses.back();
+                    query->snapshot = snapshot;
+                    query->args = args;
+                    pool.submit(move(query));
+                    continue;
+                }
+                else
+                {
+                    succeeded = run_command(args, out, err);
+                    connection.list = active_list;
+                }
+
+                connection.responses.emplace_back();
+                connection.responses.back().ready = true;
+                append_response(connection.responses.back().bytes, succeeded, out.str(), err.str());
+            }
+            connection.input.erase(0, used);
+            answered.push_back(&connection);
         }
-    }
 
-    // Adjust offset by 1 before returning
-    // (User input starts at 1 while
-    // position in vectors starts at 0)
-    return input_num - 1;
-}
+        // Every change is on disk before it is reported as done
+        flush_changes();
 
-bool is_valid_date(string date_str)
-{
-    int day, month, year;
+        // Snapshots of lists that were unloaded are of no more use
+        for (auto *published : {&snapshots, &spares})
+            for (auto it = published->begin(); it != published->end(); )
+            {
+                if (it->first != active_list && parked_lists.count(it->first) == 0)
+                    it = published->erase(it);
+                else
+                    ++it;
+            }
 
-    // Extract day, month, year from date_str
-    int matches = sscanf(date_str.c_str(), "%d /%d /%d", &day, &month, &year);
+        for (Connection *connection : answered)
+        {
+            // Connections may be listed twice
+            if (connection->fd == -1)
+                continue;
 
-    // Proceed only if there are exactly three matches
-    if (matches != 3)
-        return false;
+            // Answers go out in the order of the requests
+            while (!connection->responses.empty() && connection->responses.front().ready)
+            {
+                connection->output += connection->responses.front().bytes;
+                connection->responses.pop_front();
+            }
 
-    // Conditions: 
-    // 1. Year should not be a negative number
-    // 2. Month should be in range [1, 12]
-    // 3. Date should be over 0
-    // 4. Date should not exceed maximum days in that particular month
-    // 5. Rule 3, with an exception for second month if it is a leap year (28 -> 29)
+            // Answers to a client that went away are dropped
+            if (!send_output(*connection))
+            {
+                connection->closed = true;
+                connection->output.clear();
+                connection->sent = 0;
+            }
+            bool pending = !connection->output.empty();
+            bool done = connection->closed && !pending && connection->responses.empty();
 
-    if (year < 1) {
-        return false;
-    }
+            // Readers still point to the connection until they are done
+            if (done && connection->queries == 0)
+            {
+                epoll_ctl(events_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+                ::close(connection->fd);
+                finished.push_back(connection->fd);
+                connection->fd = -1;
+                continue;
+            }
 
-    if (month < 1 || month > 12) {
-        return false;
+            // Wait until the client takes the rest of its responses,
+            // and stop reading from clients that sent everything
+            uint32_t wanted = (connection->closed ? 0u : (uint32_t)(EPOLLIN | EPOLLRDHUP)) |
+                              (pending ? (uint32_t)EPOLLOUT : 0u);
+            if (wanted != connection->events)
+            {
+                epoll_event changed = {};
+                changed.events = wanted;
+                changed.data.ptr = connection;
+                epoll_ctl(events_fd, EPOLL_CTL_MOD, connection->fd, &changed);
+                connection->events = wanted;
+            }
+        }
+
+        for (int fd : finished)
+            connections.erase(fd);
+        finished.clear();
+        answered.clear();
     }
 
-    // Array to match month with respective days
-    const int days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    for (auto &entry : connections)
+        if (entry.second.fd != -1)
+            ::close(entry.second.fd);
+    ::close(events_fd);
+    ::close(listener);
+    unlink(path);
 
-    if (day < 1)
-        return false;
+    cerr << "Stopped serving on " << path << endl;
+    return true;
+}
 
-    if (month == 2 && is_leap_year(year))
-    {
-        if (day > 29)
-            return false;
-    }
-    else
+// Reads exactly size bytes, or fails
+bool read_all(int fd, char *data, size_t size)
+{
+    while (size > 0)
     {
-        if (day > days_in_month[month - 1])
+        auto result = ::read(fd, data, size);
+        if (result == -1 && errno == EINTR)
+            continue;
+        if (result <= 0)
             return false;
+        data += result;
+        size -= result;
     }
-
-    // Valid if all conditions are fulfilled
     return true;
 }
 
-
-bool is_leap_year(int year)
+int run_remote(const char *path, const char *list, const vector<string> &args)
 {
-    // Condition 1:
-    // Leap year if perfectly divisible by 400
-    // OR
-    // Condition 2:
-    // Leap year if not divisible by 100, AND
-    // Divisible by 4
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    int fd = strlen(path) < sizeof(address.sun_path) ?
+             socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+    if (fd != -1)
+        strcpy(address.sun_path, path);
+    if (fd == -1 || connect(fd, (sockaddr *)&address, sizeof(address)) == -1)
+    {
+        cerr << "Error: no server is listening on " << path << endl;
+        if (fd != -1)
+            ::close(fd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
 
-    if (year % 400 == 0)
-        return true;
+    // Sends a command and prints its output, returning
+    // whether it succeeded, or -1 if the server is gone
+    string request, response;
+    auto call = [&](const vector<string> &command, ostream &err) -> int {
+        request.clear();
+        encode_request(request, command);
 
-    else if (year % 100 != 0 && year % 4 == 0)
-        return true;
+        char header[9];
+        if (!write_all(fd, request.data(), request.size()) || !read_all(fd, header, sizeof(header)))
+            return -1;
 
-    else
-        return false;
-}
+        uint32_t output_size = get_u32(header + 1), errors_size = get_u32(header + 5);
+        response.resize((size_t)output_size + errors_size);
+        if (!read_all(fd, &response[0], response.size()))
+            return -1;
 
-string get_date_input()
-{
-    string date_str;
-    int day, month, year;
-    stringstream result;
+        cout.write(response.data(), output_size);
+        err.write(response.data() + output_size, errors_size);
+        return header[0] == 0;
+    };
 
-    // Prompt until receives valid input
-    while (true)
+    // Commands from a file, or from standard input
+    ifstream file;
+    if (args[0] == "batch" && args.size() == 2 && args[1] != "-")
     {
-        // Get the whole line to parse
-        getline(cin, date_str);
-
-        // Input has passed validation checking
-        if (is_valid_date(date_str))
-            break; // Continue onto next step
-
-        // Prompt for reenter
-        cout << "Please enter a valid date: ";
+        file.open(args[1]);
+        if (!file)
+        {
+            cerr << "Cannot open " << args[1] << endl;
+            ::close(fd);
+            return 1;
+        }
     }
 
-    // Arguments breakdown for sscanf function call
-    // 1. Convert date_str from std::string to char* (C style string).
-    // 2. C style conversion specification: %d, stands for digits/numbers.
-    //    Second argument stands for "Match a digit, followed by zero or
-    //    more spaces, a slash character, space character(s), a single
-    //    slash, and a digit". This allows extraction of wanted information
-    //    from a string.
-    // 3. 3 pointers to 3 variables, holding the extracted day, month, and
-    //    year. Extracted digits will be assigned to these variables by
-    //    sscanf function.
-    //
-    sscanf(date_str.c_str(), "%d /%d /%d", &day, &month, &year);
-
-    // Perform string concatenation for final result
-    result << day << "/" << month << "/" << year;
+    int result = 1;
+    if (list != nullptr)
+        result = call({ "use", list }, cerr);
 
-    // Convert to C++ style std::string and return
-    return result.str();
-}
+    if (result == 1 && args[0] != "batch")
+        result = call(args, cerr);
+    else if (result == 1)
+    {
+        istream &in = file.is_open() ? file : cin;
 
-void save_data()
-{
-    // Create object for file output
-    ofstream fout;
+        // Same as run_batch(), but every command runs on the server
+        string line;
+        vector<string> command;
+        ostringstream errors;
+        int line_number = 0, failed = 0;
+        while (result != -1 && getline(in, line))
+        {
+            line_number++;
+            if (!split_command_line(line, command))
+            {
+                cerr << "Line " << line_number << ": unterminated quote" << endl;
+                failed++;
+                continue;
+            }
+            if (command.empty() || command[0][0] == '#')
+                continue;
 
-    // Open file specified by DATA_PATH constant for output,
-    // in overwrite mode
-    fout.open(DATA_PATH, ios::out);
+            result = call(command, errors);
+            if (result == 0)
+            {
+                cerr << "Line " << line_number << ": " << errors.str();
+                failed++;
+            }
+            if (errors.tellp() > 0)
+                errors.str(string());
+        }
+        if (result != -1)
+            result = failed == 0;
+    }
 
-    // Loop through each item in todo_items vector
-    for (const auto &item : todo_items)
+    ::close(fd);
+    if (result == -1)
     {
-        // Write item details to the file in CSV format
-        // with each field enclosed in quotes
-        fout << "\"" << item.title << "\","
-            << "\"" << item.description << "\","
-            << "\"" << item.due_date << "\","
-            << "\"" << item.completed << "\""
-            << endl;  // Indicates end of line/single entry
+        cerr << "Error: lost the connection to " << path << endl;
+        return 1;
     }
-
-    // Close the file to ensure all data is written safely
-    // and release the resources
-    fout.close();
+    return result == 1 ? 0 : 1;
 }
 
-TodoItems retrieve_data()
-{
-    // Create object to hold the data of each task
-    TodoItem item;
-    // Create vector object to store all tasks as a list
-    TodoItems items;
-
-    // Create an ifstream object for file input
-    // and open file specified by DATA_PATH to read
-    ifstream file(DATA_PATH);
-    // String variable to hold each line read from the file
-    string line;
-
-    // Define a regular expression pattern to match the CSV format fields
-    // Detailed explanation:
-    // - The pattern first matches a quote character (\"), zero or more
-    //   characters that are not quotes (([^\"]*)), a quote character (\"),
-    //   followed by a single comma character (,)
-    // - The pattern is repeated four times to match the four fields:
-    //   title, description, due_date, completed
-    regex pattern("\"([^\"]*)\",\"([^\"]*)\",\"([^\"]*)\",\"([^\"]*)\"");
-
-    // Create smatch object to hold the matched results
-    smatch matches;
-
-    // Loop through each line in the file
-    // Until it reaches the bottom (EOF, end of file)
-    while (getline(file, line))
-    {
-        // Use regex search to match the line against the defined pattern
-        regex_search(line, matches, pattern);
-
-        // Extract the matched substrings and assign them
-        // to the corresponding fields in item struct
-        item.title = matches.str(1);
-        item.description = matches.str(2);
-        item.due_date = matches.str(3);
-        
-        // Convert the string "1" or "0" to a boolean type in C++
-        // and assign to .completed field/attribute
-        item.completed = matches.str(4) == "1" ? true : false;
+#else // No epoll
 
-        // Add item to the end of items list
-        items.push_back(item);
-    }
+bool serve(const char *path)
+{
+    cerr << "Error: serving on " << path << " needs epoll, which only Linux has" << endl;
+    return false;
+}
 
-    // Close the file and release resources
-    file.close();
+int run_remote(const char *path, const char *list, const vector<string> &args)
+{
+    cerr << "Error: connecting to " << path << " is only supported on Linux" << endl;
+    return 1;
+}
 
-    // Return the list of retrieved items
-    return items;
-}
\ No newline at end of file
+#endif // __linux__